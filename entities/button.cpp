@@ -18,8 +18,8 @@ void Button::init()
 
     auto subscription = HaControl::mqttClient()->subscribe(baseTopic());
     if (subscription) {
-        connect(subscription, &QMqttSubscription::messageReceived, this, [this](const QMqttMessage &) {
-            Q_EMIT triggered();
+        connect(subscription, &QMqttSubscription::messageReceived, this, [this](const QMqttMessage &message) {
+            Q_EMIT triggered(message.payload());
         });
     }
 }
@@ -10,7 +10,8 @@ class Button : public Entity
 public:
     Button(QObject *parent = nullptr);
 Q_SIGNALS:
-    void triggered();
+    // payload is "PRESS" for presses from the UI, services can send anything
+    void triggered(const QByteArray &payload);
 
 protected:
     void init() override;
@@ -104,6 +104,10 @@ void Entity::setDiscoveryConfig(const QString &key, const QVariant &value)
 
 void Entity::setHaIcon(const QString &newHaIcon)
 {
+    // The icon lives in the retained discovery config, don't republish it for nothing
+    if (m_haIcon == newHaIcon) {
+        return;
+    }
     m_haIcon = newHaIcon;
     sendRegistration();
 }
@@ -115,7 +115,9 @@ public:
      * @details
      * Sets the icon that will be displayed for this entity in Home Assistant.
      * The icon name should follow Material Design Icons naming convention.
-     * Setting the icon triggers re-registration with Home Assistant.
+     * Setting a different icon triggers re-registration with Home Assistant,
+     * so avoid it for icons that follow the state. Publish those as an
+     * attribute instead.
      */
     void setHaIcon(const QString &newHaIcon);
     
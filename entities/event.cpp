@@ -3,26 +3,61 @@
 
 #include "event.h"
 #include "core.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QMqttClient>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(evt)
+Q_LOGGING_CATEGORY(evt, "entities.Event")
+
 Event::Event(QObject *parent)
     : Entity(parent)
 {
 }
 
+void Event::setEventTypes(const QStringList &eventTypes)
+{
+    if (eventTypes == m_eventTypes) {
+        return;
+    }
+    m_eventTypes = eventTypes;
+    setDiscoveryConfig("event_types", QJsonArray::fromStringList(m_eventTypes));
+    if (HaControl::mqttClient()->state() == QMqttClient::Connected) {
+        sendRegistration();
+    }
+}
+
+QStringList Event::eventTypes() const
+{
+    return m_eventTypes;
+}
+
 void Event::init()
 {
+    // Events used to be device triggers, drop that discovery config so HA doesn't show both
     setHaType("device_automation");
-    setDiscoveryConfig("automation_type", "trigger");
-    setDiscoveryConfig("topic", baseTopic());
-    setDiscoveryConfig("type", QStringLiteral("button_short_press"));
-    setDiscoveryConfig("subtype", name());
+    unRegister();
+
+    setHaType("event");
+    setDiscoveryConfig("state_topic", baseTopic());
+    setDiscoveryConfig("event_types", QJsonArray::fromStringList(m_eventTypes));
     sendRegistration();
 }
 
-void Event::trigger()
+void Event::trigger(const QString &eventType, const QVariantMap &attributes)
 {
-    if (HaControl::mqttClient()->state() == QMqttClient::Connected) {
-        HaControl::mqttClient()->publish(baseTopic(), "pressed", 0, false);
-        HaControl::mqttClient()->publish(baseTopic(), "", 0, true);
+    if (!m_eventTypes.contains(eventType)) {
+        qCWarning(evt) << "Event type" << eventType << "not declared for" << id();
+        return;
+    }
+    if (HaControl::mqttClient()->state() != QMqttClient::Connected) {
+        return;
     }
+
+    // One message per event, not retained so a restart of HA doesn't replay it
+    QJsonObject payload = QJsonObject::fromVariantMap(attributes);
+    payload["event_type"] = eventType;
+    HaControl::mqttClient()->publish(baseTopic(), QJsonDocument(payload).toJson(QJsonDocument::Compact), 0, false);
 }
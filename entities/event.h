@@ -4,13 +4,24 @@
 #pragma once
 #include "entity.h"
 
+#include <QStringList>
+#include <QVariantMap>
+
 class Event : public Entity
 {
     Q_OBJECT
 public:
     Event(QObject *parent = nullptr);
-    void trigger();
+
+    // Every type passed to trigger() has to be declared here, HA drops unknown ones. Defaults to "press"
+    void setEventTypes(const QStringList &eventTypes);
+    QStringList eventTypes() const;
+
+    void trigger(const QString &eventType = QStringLiteral("press"), const QVariantMap &attributes = {});
 
 protected:
     void init() override;
-};
\ No newline at end of file
+
+private:
+    QStringList m_eventTypes = {QStringLiteral("press")};
+};
@@ -4,6 +4,7 @@
 #include "number.h"
 #include "core.h"
 #include <QMqttClient>
+#include <QTimer>
 
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(numb)
@@ -17,10 +18,24 @@ Number::Number(QObject *parent)
 
 void Number::setRange(int min, int max, int step, const QString &unit)
 {
+    if (m_min == min && m_max == max && m_step == step && m_unit == unit) {
+        return;
+    }
     m_min = min;
     m_max = max;
     m_step = step;
     m_unit = unit;
+
+    setDiscoveryConfig("min", QString::number(m_min));
+    setDiscoveryConfig("max", QString::number(m_max));
+    setDiscoveryConfig("step", QString::number(m_step));
+    setDiscoveryConfig("unit_of_measurement", m_unit);
+
+    // Already registered, only the discovery config needs updating. No need to subscribe again.
+    // Before init() the config lacks its topics, HA would reject it; init() sends the new range anyway
+    if (m_registered && HaControl::mqttClient()->state() == QMqttClient::Connected) {
+        sendRegistration();
+    }
 }
 
 void Number::init()
@@ -33,8 +48,9 @@ void Number::init()
     setDiscoveryConfig("unit_of_measurement", m_unit);
 
     sendRegistration();
+    m_registered = true;
 
-    setValue(m_value);
+    publishValue();
 
     auto subscription = HaControl::mqttClient()->subscribe(baseTopic() + "/set");
     if (subscription) {
@@ -42,7 +58,7 @@ void Number::init()
             bool ok = false;
             int newValue = message.payload().toInt(&ok);
             if (ok) {
-                Q_EMIT valueChangeRequested(newValue);
+                onCommand(newValue);
             } else {
                 qCWarning(numb) << "Invalid payload for number entity:" << message.payload();
             }
@@ -50,11 +66,66 @@ void Number::init()
     }
 }
 
+void Number::setCommandThrottle(int msecs)
+{
+    if (msecs <= 0) {
+        delete m_commandTimer;
+        m_commandTimer = nullptr;
+        return;
+    }
+    if (!m_commandTimer) {
+        m_commandTimer = new QTimer(this);
+        m_commandTimer->setSingleShot(true);
+        connect(m_commandTimer, &QTimer::timeout, this, &Number::onCommandTimeout);
+    }
+    m_commandTimer->setInterval(msecs);
+}
+
+void Number::onCommand(int value)
+{
+    if (!m_commandTimer) {
+        Q_EMIT valueChangeRequested(value);
+        return;
+    }
+    // Leading edge goes straight through, everything after that waits for the timer
+    if (m_commandTimer->isActive()) {
+        m_pendingCommand = value;
+        m_hasPendingCommand = true;
+        return;
+    }
+    m_commandTimer->start();
+    Q_EMIT valueChangeRequested(value);
+}
+
+void Number::onCommandTimeout()
+{
+    if (m_hasPendingCommand) {
+        m_hasPendingCommand = false;
+        m_commandTimer->start();
+        Q_EMIT valueChangeRequested(m_pendingCommand);
+        return;
+    }
+    // Commands stopped, publish whatever the integration settled on
+    if (m_hasPendingPublish) {
+        m_hasPendingPublish = false;
+        publishValue();
+    }
+}
+
 void Number::setValue(int value)
 {
     m_value = value;
+    if (m_commandTimer && m_commandTimer->isActive()) {
+        m_hasPendingPublish = true;
+        return;
+    }
+    publishValue();
+}
+
+void Number::publishValue()
+{
     if (HaControl::mqttClient()->state() == QMqttClient::Connected) {
-        HaControl::mqttClient()->publish(baseTopic(), QByteArray::number(value), 0, true);
+        HaControl::mqttClient()->publish(baseTopic(), QByteArray::number(m_value), 0, true);
     }
 }
 
@@ -4,6 +4,8 @@
 #pragma once
 #include "entity.h"
 
+class QTimer;
+
 class Number : public Entity
 {
     Q_OBJECT
@@ -11,12 +13,17 @@ public:
     Number(QObject *parent = nullptr);
     void setValue(int value);
     int value();
-    // Optional customization for integrations before init()
+    // Optional customization for integrations, changing it after init() republishes discovery only
     void setRange(int min, int max, int step = 1, const QString &unit = "%");
     //returns the max value set
     int max();
     //returns the min value set
     int min();
+    // Coalesce incoming commands, valueChangeRequested is emitted at most once per interval
+    // with the latest requested value. While commands are arriving, setValue() only records
+    // the value so echoes of our own changes are not published, the final value is published
+    // once the commands stop. 0 (the default) disables this.
+    void setCommandThrottle(int msecs);
 
 protected:
     void init() override;
@@ -25,9 +32,19 @@ Q_SIGNALS:
     void valueChangeRequested(int value);
 
 private:
+    void onCommand(int value);
+    void onCommandTimeout();
+    void publishValue();
+
     int m_value = 0;
     int m_min = 0;
     int m_max = 100;
     int m_step = 1;
     QString m_unit = "%";
+    bool m_registered = false; // init() ran, the discovery config has its topics
+
+    QTimer *m_commandTimer = nullptr;
+    int m_pendingCommand = 0;
+    bool m_hasPendingCommand = false;
+    bool m_hasPendingPublish = false;
 };
@@ -20,13 +20,19 @@ Select::Select(QObject *parent)
 
 void Select::setOptions(const QStringList &opts)
 {
+    // Options live in the retained discovery config, only republish it when they changed
+    if (opts == m_options) {
+        return;
+    }
     m_options = opts;
 
     // Hvis HA er registrert, må config oppdateres
     setDiscoveryConfig("state_topic", baseTopic());
     setDiscoveryConfig("command_topic", baseTopic() + "/set");
     setDiscoveryConfig("options", QJsonArray::fromStringList(m_options));
-    sendRegistration();
+    if (m_registered && HaControl::mqttClient()->state() == QMqttClient::Connected) {
+        sendRegistration();
+    }
 }
 
 void Select::setState(const QString &state)
@@ -53,6 +59,7 @@ void Select::init()
 
     // Fortell HA at entiteten finnes
     sendRegistration();
+    m_registered = true;
 
     // Publiser initial state hvis satt
     publishState();
@@ -26,4 +26,5 @@ private:
 
     QString m_state;
     QStringList m_options;
+    bool m_registered = false; // init() ran, later option changes republish the config
 };
\ No newline at end of file
@@ -3,144 +3,371 @@
 
 #include "core.h"
 #include "entities/entities.h"
+#include "kwinscript.h"
+#include <KConfigGroup>
+#include <KIdleTime>
+#include <KSharedConfig>
 #include <QCoreApplication>
 #include <QDBusConnection>
-#include <QDBusInterface>
-#include <QDBusReply>
-#include <QFile>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonValue>
-#include <QStandardPaths>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDate>
+#include <QElapsedTimer>
 #include <QTimer>
 
+#include <algorithm>
+
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(aw)
 Q_LOGGING_CATEGORY(aw, "integration.ActiveWindow")
 
-class ActiveWindowWatcher : public QObject
+// Same idle threshold as the Active sensor
+static constexpr int s_focusIdleTimeout = 60 * 1000;
+// Totals only need to be roughly current in HA, publish and save every few minutes
+static constexpr int s_focusPublishInterval = 5 * 60 * 1000;
+static constexpr int s_focusTopApplications = 10;
+
+// Accumulates focused time per application for the current day.
+// Time only counts while the user is active and the session is unlocked.
+class FocusTimeTracker : public QObject
 {
     Q_OBJECT
-    Q_CLASSINFO("D-Bus Interface", "org.davidedmundson.kiot.ActiveWindow")
-
 public:
-    explicit ActiveWindowWatcher(QObject *parent = nullptr);
-    ~ActiveWindowWatcher();
-public slots:
-    Q_SCRIPTABLE void UpdateAttributes(const QVariantMap &attributes);
+    explicit FocusTimeTracker(QObject *parent = nullptr);
+    ~FocusTimeTracker();
+
+    void setApplication(const QString &resourceClass);
+
+private Q_SLOTS:
+    void screenLockedChanged(bool active);
 
 private:
-    bool registerKWinScript();
-    void cleanup();
+    bool counting() const;
+    void accumulate(bool wentIdle = false);
+    void setPaused(bool idle, bool locked);
+    void publish();
+    void load();
+    void save();
+
     Sensor *m_sensor;
-    QDBusInterface *m_kwinIface = nullptr;
-    QString m_lastTitle;
-    QString m_scriptPath;
-    bool m_connected = false;
+    QTimer *m_publishTimer;
+    struct Booking {
+        QString application;
+        qint64 start;
+        qint64 end;
+    };
+
+    QElapsedTimer m_clock; // monotonic, all times below are relative to it
+    qint64 m_segmentStart = 0; // moved on whenever time is booked
+    QList<Booking> m_recent; // booked within the idle timeout, see accumulate()
+    QHash<QString, qint64> m_totals; // resourceClass -> msecs today
+    QString m_current;
+    QDate m_day;
+    bool m_idle = false;
+    bool m_locked = false;
+    int m_idleTimeoutId = -1;
 };
 
-ActiveWindowWatcher::ActiveWindowWatcher(QObject *parent)
+FocusTimeTracker::FocusTimeTracker(QObject *parent)
     : QObject(parent)
+    , m_publishTimer(new QTimer(this))
 {
     m_sensor = new Sensor(this);
-    m_sensor->setId("active_window");
-    m_sensor->setName("Active Window");
-    m_sensor->setDiscoveryConfig("icon", "mdi:application");
-    // Register DBus service first
-    if (!QDBusConnection::sessionBus().registerService("org.davidedmundson.kiot.ActiveWindow")) {
-        qCWarning(aw) << "ActiveWindowWatcher: Failed to register DBus service";
-        m_sensor->setState("Unavailable");
-        return;
+    m_sensor->setId("focus_time");
+    m_sensor->setName("Focus Time Today");
+    m_sensor->setDiscoveryConfig("icon", "mdi:timer-outline");
+    m_sensor->setDiscoveryConfig("unit_of_measurement", "min");
+    m_sensor->setDiscoveryConfig("state_class", "total_increasing");
+
+    load();
+    m_clock.start();
+
+    auto kidletime = KIdleTime::instance();
+    m_idleTimeoutId = kidletime->addIdleTimeout(s_focusIdleTimeout);
+    connect(kidletime, &KIdleTime::resumingFromIdle, this, [this]() {
+        setPaused(false, m_locked);
+    });
+    connect(kidletime, &KIdleTime::timeoutReached, this, [this, kidletime](int id) {
+        if (id != m_idleTimeoutId) {
+            return;
+        }
+        setPaused(true, m_locked);
+        kidletime->catchNextResumeEvent();
+    });
+
+    QDBusConnection::sessionBus().connect(QStringLiteral("org.freedesktop.ScreenSaver"),
+                                          QStringLiteral("/ScreenSaver"),
+                                          QStringLiteral("org.freedesktop.ScreenSaver"),
+                                          QStringLiteral("ActiveChanged"),
+                                          this,
+                                          SLOT(screenLockedChanged(bool)));
+    // Started with the screen already locked, nothing counts until it's unlocked
+    const QDBusMessage getActive = QDBusMessage::createMethodCall(QStringLiteral("org.freedesktop.ScreenSaver"),
+                                                                  QStringLiteral("/ScreenSaver"),
+                                                                  QStringLiteral("org.freedesktop.ScreenSaver"),
+                                                                  QStringLiteral("GetActive"));
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(getActive), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        const QDBusPendingReply<bool> reply = *watcher;
+        if (!reply.isError()) {
+            screenLockedChanged(reply.value());
+        }
+    });
+
+    m_publishTimer->setInterval(s_focusPublishInterval);
+    connect(m_publishTimer, &QTimer::timeout, this, &FocusTimeTracker::publish);
+    m_publishTimer->start();
+    publish();
+}
+
+FocusTimeTracker::~FocusTimeTracker()
+{
+    accumulate();
+    save();
+}
+
+bool FocusTimeTracker::counting() const
+{
+    return !m_current.isEmpty() && !m_idle && !m_locked;
+}
+
+void FocusTimeTracker::accumulate(bool wentIdle)
+{
+    const qint64 now = m_clock.elapsed();
+    qint64 start = m_segmentStart;
+    m_segmentStart = now;
+
+    // Time after midnight belongs to the new day, what was booked before it is dropped with the old day
+    if (m_day != QDate::currentDate()) {
+        m_day = QDate::currentDate();
+        m_totals.clear();
+        m_recent.clear();
+        start = qMax(start, now - QTime(0, 0).msecsTo(QTime::currentTime()));
     }
 
-    if (!QDBusConnection::sessionBus().registerObject("/ActiveWindow", "org.davidedmundson.kiot.ActiveWindow", this, QDBusConnection::ExportAllSlots)) {
-        qCWarning(aw) << "ActiveWindowWatcher: Failed to register DBus object";
-        m_sensor->setState("Unavailable");
-        return;
+    qint64 end = now;
+    if (wentIdle) {
+        // The idle timeout fires after the user was already gone for a while. That part doesn't
+        // count, whichever application it was booked on, but time before it still does
+        const qint64 idleSince = now - s_focusIdleTimeout;
+        end = qMax(start, idleSince);
+        for (const Booking &booking : std::as_const(m_recent)) {
+            if (booking.end <= idleSince) {
+                continue;
+            }
+            auto it = m_totals.find(booking.application);
+            if (it != m_totals.end()) {
+                it.value() -= booking.end - qMax(booking.start, idleSince);
+                if (it.value() <= 0) {
+                    m_totals.erase(it);
+                }
+            }
+        }
+        m_recent.clear();
     }
 
-    if (!registerKWinScript()) {
-        qCWarning(aw) << "ActiveWindowWatcher: Failed to register KWin script";
-        m_sensor->setState("Unavailable");
+    if (counting() && end > start) {
+        m_totals[m_current] += end - start;
+        m_recent.append({m_current, start, end});
+    }
+    m_recent.removeIf([now](const Booking &booking) {
+        return booking.end <= now - s_focusIdleTimeout;
+    });
+}
+
+void FocusTimeTracker::setApplication(const QString &resourceClass)
+{
+    if (resourceClass == m_current) {
         return;
     }
+    accumulate();
+    m_current = resourceClass;
 }
 
-ActiveWindowWatcher::~ActiveWindowWatcher()
+void FocusTimeTracker::setPaused(bool idle, bool locked)
 {
-    cleanup();
+    if (idle == m_idle && locked == m_locked) {
+        return;
+    }
+    accumulate(idle && !m_idle);
+    m_idle = idle;
+    m_locked = locked;
 }
 
-void ActiveWindowWatcher::cleanup()
+void FocusTimeTracker::screenLockedChanged(bool active)
 {
-    m_kwinIface->call("unloadScript", "kiot_activewindow");
+    setPaused(m_idle, active);
 }
-bool ActiveWindowWatcher::registerKWinScript()
+
+void FocusTimeTracker::publish()
 {
-    m_kwinIface = new QDBusInterface("org.kde.KWin", "/Scripting", "org.kde.kwin.Scripting", QDBusConnection::sessionBus(), this);
+    accumulate();
 
-    if (!m_kwinIface->isValid()) {
-        qCWarning(aw) << "ActiveWindowWatcher: KWin scripting interface not available";
-        return false;
+    QList<QPair<QString, qint64>> sorted;
+    sorted.reserve(m_totals.size());
+    qint64 total = 0;
+    for (auto it = m_totals.cbegin(); it != m_totals.cend(); ++it) {
+        sorted.append({it.key(), it.value()});
+        total += it.value();
     }
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second > b.second;
+    });
 
-    // Clean up any existing instance
-    cleanup();
+    QVariantList top;
+    for (const auto &[application, msecs] : std::as_const(sorted)) {
+        if (top.size() >= s_focusTopApplications) {
+            break;
+        }
+        QVariantMap entry;
+        entry["application"] = application;
+        entry["minutes"] = msecs / 60000;
+        top.append(entry);
+    }
 
-    // Locate installed KWin script from KDE data dirs
-    m_scriptPath = QStandardPaths::locate(QStandardPaths::GenericDataLocation, QStringLiteral("kiot/activewindow_kwin.js"));
-    if (m_scriptPath.isEmpty()) {
-        qCWarning(aw) << "ActiveWindowWatcher: installed KWin script not found in data dirs";
-        return false;
+    QVariantMap attributes;
+    attributes["date"] = m_day.toString(Qt::ISODate);
+    attributes["applications"] = top;
+    m_sensor->setState(QString::number(total / 60000));
+    if (m_sensor->attributes() != attributes) {
+        m_sensor->setAttributes(attributes);
     }
+    save();
+}
 
-    QDBusMessage reply = m_kwinIface->call("loadScript", m_scriptPath, "kiot_activewindow");
-    if (reply.type() == QDBusMessage::ErrorMessage) {
-        qCWarning(aw) << "ActiveWindowWatcher: loadScript failed:" << reply.errorMessage();
-        return false;
+void FocusTimeTracker::load()
+{
+    // Counters survive restarts as long as it's still the same day
+    const KConfigGroup group = KSharedConfig::openStateConfig()->group(QStringLiteral("FocusTime"));
+    m_day = QDate::fromString(group.readEntry("Date", QString()), Qt::ISODate);
+    if (m_day != QDate::currentDate()) {
+        m_day = QDate::currentDate();
+        return;
+    }
+    const KConfigGroup totals = group.group(QStringLiteral("Totals"));
+    const QStringList applications = totals.keyList();
+    for (const QString &application : applications) {
+        m_totals.insert(application, totals.readEntry(application, qint64(0)) * 1000);
     }
+}
 
-    if (reply.arguments().isEmpty()) {
-        qCWarning(aw) << "ActiveWindowWatcher: loadScript returned no arguments";
-        return false;
+void FocusTimeTracker::save()
+{
+    KConfigGroup group = KSharedConfig::openStateConfig()->group(QStringLiteral("FocusTime"));
+    group.writeEntry("Date", m_day.toString(Qt::ISODate));
+    KConfigGroup totals = group.group(QStringLiteral("Totals"));
+    totals.deleteGroup();
+    for (auto it = m_totals.cbegin(); it != m_totals.cend(); ++it) {
+        totals.writeEntry(it.key(), it.value() / 1000);
     }
+    group.sync();
+}
+
+class ActiveWindowWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ActiveWindowWatcher(QObject *parent = nullptr);
+
+private:
+    void onActiveWindow(const QVariantMap &attributes);
+    void publish();
+    Sensor *m_sensor;
+    BinarySensor *m_fullscreen;
+    Sensor *m_windowCount;
+    FocusTimeTracker *m_focusTime = nullptr;
+    QTimer *m_publishTimer = nullptr;
+    QVariantMap m_pendingAttributes;
+    QString m_lastTitle;
+};
 
-    QVariant arg = reply.arguments().first();
-    QString scriptObjectPath;
+// Geometry only changes are held back this long, so a burst of them publishes once
+static constexpr int s_geometryCoalesceInterval = 500;
 
-    // KWin returns an int for the script ID in all supported versions
-    if (arg.canConvert<int>()) {
-        int id = arg.toInt();
-        scriptObjectPath = QString("/Scripting/Script%1").arg(id);
-    } else {
-        qCWarning(aw) << "ActiveWindowWatcher: Unexpected return type from loadScript:" << arg.typeName();
-        return false;
+ActiveWindowWatcher::ActiveWindowWatcher(QObject *parent)
+    : QObject(parent)
+    , m_publishTimer(new QTimer(this))
+{
+    m_sensor = new Sensor(this);
+    m_sensor->setId("active_window");
+    m_sensor->setName("Active Window");
+    m_sensor->setDiscoveryConfig("icon", "mdi:application");
+
+    m_fullscreen = new BinarySensor(this);
+    m_fullscreen->setId("fullscreen");
+    m_fullscreen->setName("Fullscreen Window");
+    m_fullscreen->setDiscoveryConfig("icon", "mdi:fullscreen");
+
+    m_windowCount = new Sensor(this);
+    m_windowCount->setId("window_count");
+    m_windowCount->setName("Open Windows");
+    m_windowCount->setDiscoveryConfig("icon", "mdi:window-restore");
+    m_windowCount->setDiscoveryConfig("state_class", "measurement");
+
+    m_publishTimer->setSingleShot(true);
+    m_publishTimer->setInterval(s_geometryCoalesceInterval);
+    connect(m_publishTimer, &QTimer::timeout, this, &ActiveWindowWatcher::publish);
+
+    if (KSharedConfig::openConfig()->group(QStringLiteral("ActiveWindow")).readEntry("FocusTime", false)) {
+        m_focusTime = new FocusTimeTracker(this);
     }
-    QDBusInterface scriptIface("org.kde.KWin", scriptObjectPath, "org.kde.kwin.Script", QDBusConnection::sessionBus());
-    if (!scriptIface.isValid()) {
-        qCWarning(aw) << "ActiveWindowWatcher: scriptIface invalid for path" << scriptObjectPath;
-        QFile::remove(m_scriptPath);
-        return false;
+
+    // The script only sends events that differ from the previous one of the same type
+    KWinScript::self()->subscribe(QStringLiteral("activeWindow"), this, [this](const QVariantMap &event) {
+        onActiveWindow(event);
+    });
+    KWinScript::self()->subscribe(QStringLiteral("fullscreen"), this, [this](const QVariantMap &event) {
+        m_fullscreen->setState(event.value("active").toBool());
+        m_fullscreen->setAttributes({{"resourceClass", event.value("resourceClass")}});
+    });
+    KWinScript::self()->subscribe(QStringLiteral("windowCount"), this, [this](const QVariantMap &event) {
+        m_windowCount->setState(QString::number(event.value("count").toInt()));
+    });
+
+    // Not a KWin session or the script couldn't be loaded, nothing will ever arrive
+    auto setUnavailable = [this]() {
+        m_sensor->setState("Unavailable");
+        m_windowCount->setState("Unavailable");
+        m_fullscreen->setState(false);
+    };
+    if (KWinScript::self()->hasFailed()) {
+        setUnavailable();
     }
+    connect(KWinScript::self(), &KWinScript::loadFailed, this, setUnavailable);
+}
 
-    QDBusMessage runReply = scriptIface.call("run");
-    if (runReply.type() == QDBusMessage::ErrorMessage) {
-        qCWarning(aw) << "ActiveWindowWatcher: run failed:" << runReply.errorMessage();
-        QFile::remove(m_scriptPath);
-        return false;
+void ActiveWindowWatcher::onActiveWindow(const QVariantMap &attributes)
+{
+    m_pendingAttributes = attributes;
+    if (m_focusTime) {
+        m_focusTime->setApplication(attributes.value("resourceClass").toString());
     }
 
-    return true;
+    // Focus and title changes are what people automate on, publish those right away.
+    // Anything else (geometry, mostly) waits for the timer and only the latest is sent.
+    const QVariantMap published = m_sensor->attributes();
+    if (attributes.value("title") != published.value("title") || attributes.value("resourceClass") != published.value("resourceClass")) {
+        m_publishTimer->stop();
+        publish();
+    } else if (!m_publishTimer->isActive()) {
+        m_publishTimer->start();
+    }
 }
 
-void ActiveWindowWatcher::UpdateAttributes(const QVariantMap &attributes)
+void ActiveWindowWatcher::publish()
 {
-    QString title = attributes["title"].toString();
+    if (m_pendingAttributes.isEmpty() || m_pendingAttributes == m_sensor->attributes()) {
+        return;
+    }
+    QString title = m_pendingAttributes["title"].toString();
     if (title != m_lastTitle) {
         m_lastTitle = title;
         m_sensor->setState(title);
     }
-    m_sensor->setAttributes(attributes);
+    m_sensor->setAttributes(m_pendingAttributes);
 }
 
 void setupActiveWindow()
@@ -4,20 +4,425 @@
 #include "core.h"
 #include "entities/number.h"
 #include "entities/select.h"
+#include "entities/sensor.h"
+#include "entities/switch.h"
+#include "inotifyhub.h"
 
+#include <PulseAudioQt/Client>
 #include <PulseAudioQt/Context>
+#include <PulseAudioQt/Port>
 #include <PulseAudioQt/Server>
 #include <PulseAudioQt/Sink>
+#include <PulseAudioQt/SinkInput>
 #include <PulseAudioQt/Source>
 #include <PulseAudioQt/VolumeObject>
 
-#include <QFileSystemWatcher>
-#include <QFile>
+#include <KConfigGroup>
+#include <KConfigWatcher>
+#include <KSandbox>
+#include <KSharedConfig>
+
 #include <QDir>
+#include <QPointer>
+#include <QStandardPaths>
+#include <QSet>
+#include <QTimer>
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(audio)
 Q_LOGGING_CATEGORY(audio, "integrations.Audio")
 
+// Dragging a volume slider in HA sends a flood of commands, apply at most one per interval
+static constexpr int s_volumeCommandThrottle = 150;
+
+static int paToPercent(qint64 v)
+{
+    double p = (double)v / PulseAudioQt::normalVolume() * 100.0;
+    return qRound(p);
+}
+
+static qint64 percentToPa(int percent)
+{
+    return qRound(PulseAudioQt::normalVolume() * (percent / 100.0));
+}
+
+static bool isMonitorSource(const PulseAudioQt::Source *source)
+{
+    return source->properties().value(QStringLiteral("device.class")).toString() == QLatin1String("monitor");
+}
+
+// Volume, mute and active port entities for a single sink or source
+class AudioDeviceEntities : public QObject
+{
+    Q_OBJECT
+public:
+    AudioDeviceEntities(PulseAudioQt::Device *device, const QString &kind, int maxVolume, QObject *parent = nullptr);
+
+    void setMaximumVolume(int max);
+    void unRegister();
+
+Q_SIGNALS:
+    // emitted once per event loop turn after the device changed
+    void changed();
+
+private:
+    void update();
+    QStringList portOptions() const;
+
+    // Guarded, HA commands or a pending update can still arrive after PulseAudioQt dropped the device
+    QPointer<PulseAudioQt::Device> m_device;
+    Number *m_volume = nullptr;
+    Switch *m_mute = nullptr;
+    Select *m_port = nullptr;
+    QTimer *m_updateTimer = nullptr;
+};
+
+AudioDeviceEntities::AudioDeviceEntities(PulseAudioQt::Device *device, const QString &kind, int maxVolume, QObject *parent)
+    : QObject(parent)
+    , m_device(device)
+    , m_updateTimer(new QTimer(this))
+{
+    // Index based lookups are for us, ids should survive a replug or a pulseaudio restart
+    const QString id = "audio_" + kind + "_" + device->name();
+    const QString name = device->description();
+
+    m_volume = new Number(this);
+    m_volume->setId(id + "_volume");
+    m_volume->setName(name + " Volume");
+    m_volume->setDiscoveryConfig("icon", kind == QLatin1String("sink") ? "mdi:knob" : "mdi:microphone");
+    m_volume->setRange(0, maxVolume, 1, "%");
+    m_volume->setCommandThrottle(s_volumeCommandThrottle);
+    connect(m_volume, &Number::valueChangeRequested, this, [this](int v) {
+        if (m_device && v != m_volume->value())
+            m_device->setVolume(percentToPa(v));
+    });
+
+    m_mute = new Switch(this);
+    m_mute->setId(id + "_mute");
+    m_mute->setName(name + " Mute");
+    m_mute->setDiscoveryConfig("icon", kind == QLatin1String("sink") ? "mdi:volume-off" : "mdi:microphone-off");
+    connect(m_mute, &Switch::stateChangeRequested, this, [this](bool muted) {
+        if (m_device)
+            m_device->setMuted(muted);
+    });
+
+    if (!m_device->ports().isEmpty()) {
+        m_port = new Select(this);
+        m_port->setId(id + "_port");
+        m_port->setName(name + " Port");
+        m_port->setDiscoveryConfig("icon", "mdi:audio-input-stereo-minijack");
+        m_port->setOptions(portOptions());
+        connect(m_port, &Select::optionSelected, this, [this](const QString &option) {
+            if (!m_device)
+                return;
+            const auto ports = m_device->ports();
+            for (int i = 0; i < ports.size(); ++i) {
+                if (ports[i]->description() == option) {
+                    m_device->setActivePortIndex(i);
+                    return;
+                }
+            }
+            qCWarning(audio) << "Port not found:" << option;
+        });
+    }
+
+    // PulseAudio sends several property updates per change, publish once per event loop turn
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(0);
+    connect(m_updateTimer, &QTimer::timeout, this, &AudioDeviceEntities::update);
+    auto scheduleUpdate = [this]() {
+        m_updateTimer->start();
+    };
+    connect(m_device, &PulseAudioQt::VolumeObject::volumeChanged, this, scheduleUpdate);
+    connect(m_device, &PulseAudioQt::VolumeObject::mutedChanged, this, scheduleUpdate);
+    connect(m_device, &PulseAudioQt::Device::activePortIndexChanged, this, scheduleUpdate);
+    connect(m_device, &PulseAudioQt::Device::portsChanged, this, scheduleUpdate);
+
+    update();
+
+    m_volume->runtimeRegistration();
+    m_mute->runtimeRegistration();
+    if (m_port)
+        m_port->runtimeRegistration();
+}
+
+void AudioDeviceEntities::setMaximumVolume(int max)
+{
+    m_volume->setRange(0, max, 1, "%");
+}
+
+void AudioDeviceEntities::unRegister()
+{
+    m_updateTimer->stop();
+    m_volume->unRegister();
+    m_mute->unRegister();
+    if (m_port)
+        m_port->unRegister();
+}
+
+QStringList AudioDeviceEntities::portOptions() const
+{
+    QStringList options;
+    if (!m_device)
+        return options;
+    for (const auto *port : m_device->ports())
+        options.append(port->description());
+    return options;
+}
+
+void AudioDeviceEntities::update()
+{
+    if (!m_device)
+        return;
+    const int percent = paToPercent(m_device->volume());
+    if (percent != m_volume->value())
+        m_volume->setValue(percent);
+
+    if (m_device->isMuted() != m_mute->state())
+        m_mute->setState(m_device->isMuted());
+
+    if (m_port) {
+        const QStringList options = portOptions();
+        if (options != m_port->options())
+            m_port->setOptions(options);
+        const auto ports = m_device->ports();
+        const quint32 active = m_device->activePortIndex();
+        if (active < quint32(ports.size()) && ports[active]->description() != m_port->state())
+            m_port->setState(ports[active]->description());
+    }
+
+    Q_EMIT changed();
+}
+
+static QString streamApplicationName(const PulseAudioQt::SinkInput *stream)
+{
+    const QString appName = stream->properties().value(QStringLiteral("application.name")).toString();
+    if (!appName.isEmpty())
+        return appName;
+    if (stream->client() && !stream->client()->name().isEmpty())
+        return stream->client()->name();
+    return stream->name();
+}
+
+// Volume and mute entities for a single application stream
+class AudioStreamEntities : public QObject
+{
+    Q_OBJECT
+public:
+    AudioStreamEntities(PulseAudioQt::SinkInput *stream, QObject *parent = nullptr);
+
+    void unRegister();
+    PulseAudioQt::SinkInput *stream() const
+    {
+        return m_stream;
+    }
+
+Q_SIGNALS:
+    void changed();
+
+private:
+    void update();
+
+    QPointer<PulseAudioQt::SinkInput> m_stream;
+    Number *m_volume = nullptr;
+    Switch *m_mute = nullptr;
+    QTimer *m_updateTimer = nullptr;
+};
+
+AudioStreamEntities::AudioStreamEntities(PulseAudioQt::SinkInput *stream, QObject *parent)
+    : QObject(parent)
+    , m_stream(stream)
+    , m_updateTimer(new QTimer(this))
+{
+    // Streams are short lived, the index is unique for the lifetime of the pulseaudio server
+    const QString id = "audio_stream_" + QString::number(stream->index());
+    const QString name = streamApplicationName(stream);
+
+    m_volume = new Number(this);
+    m_volume->setId(id + "_volume");
+    m_volume->setName(name + " Volume");
+    m_volume->setDiscoveryConfig("icon", "mdi:application-cog");
+    m_volume->setRange(0, 100, 1, "%");
+    m_volume->setCommandThrottle(s_volumeCommandThrottle);
+    connect(m_volume, &Number::valueChangeRequested, this, [this](int v) {
+        if (m_stream && v != m_volume->value())
+            m_stream->setVolume(percentToPa(v));
+    });
+
+    m_mute = new Switch(this);
+    m_mute->setId(id + "_mute");
+    m_mute->setName(name + " Mute");
+    m_mute->setDiscoveryConfig("icon", "mdi:volume-off");
+    connect(m_mute, &Switch::stateChangeRequested, this, [this](bool muted) {
+        if (m_stream)
+            m_stream->setMuted(muted);
+    });
+
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(0);
+    connect(m_updateTimer, &QTimer::timeout, this, &AudioStreamEntities::update);
+    auto scheduleUpdate = [this]() {
+        m_updateTimer->start();
+    };
+    connect(stream, &PulseAudioQt::VolumeObject::volumeChanged, this, scheduleUpdate);
+    connect(stream, &PulseAudioQt::VolumeObject::mutedChanged, this, scheduleUpdate);
+    connect(stream, &PulseAudioQt::Stream::corkedChanged, this, scheduleUpdate);
+
+    update();
+
+    m_volume->runtimeRegistration();
+    m_mute->runtimeRegistration();
+}
+
+void AudioStreamEntities::unRegister()
+{
+    m_volume->unRegister();
+    m_mute->unRegister();
+}
+
+void AudioStreamEntities::update()
+{
+    if (!m_stream)
+        return;
+
+    const int percent = paToPercent(m_stream->volume());
+    if (percent != m_volume->value())
+        m_volume->setValue(percent);
+
+    if (m_stream->isMuted() != m_mute->state())
+        m_mute->setState(m_stream->isMuted());
+
+    Q_EMIT changed();
+}
+
+// Per application streams (sink inputs) and the "now playing" summary sensor.
+// Browsers open and close streams in bursts, so discovery changes are batched.
+class AudioStreams : public QObject
+{
+    Q_OBJECT
+public:
+    AudioStreams(PulseAudioQt::Context *ctx, QObject *parent = nullptr);
+
+private:
+    void onStreamAdded(PulseAudioQt::SinkInput *stream);
+    void onStreamRemoved(PulseAudioQt::SinkInput *stream);
+    void flushPending();
+    void updateSummary();
+
+    PulseAudioQt::Context *m_ctx;
+    Sensor *m_summary = nullptr;
+    QHash<quint32, AudioStreamEntities *> m_streams;
+    QHash<quint32, QPointer<PulseAudioQt::SinkInput>> m_pendingAdded;
+    QSet<quint32> m_pendingRemoved;
+    QTimer *m_debounceTimer = nullptr;
+    QTimer *m_summaryTimer = nullptr;
+};
+
+AudioStreams::AudioStreams(PulseAudioQt::Context *ctx, QObject *parent)
+    : QObject(parent)
+    , m_ctx(ctx)
+    , m_debounceTimer(new QTimer(this))
+    , m_summaryTimer(new QTimer(this))
+{
+    m_summary = new Sensor(this);
+    m_summary->setId("audio_playing_applications");
+    m_summary->setName("Playing Applications");
+    m_summary->setDiscoveryConfig("icon", "mdi:playlist-music");
+    m_summary->setState("0");
+
+    // Not restarted on every event so a constant stream of churn can't starve registration
+    m_debounceTimer->setSingleShot(true);
+    m_debounceTimer->setInterval(1000);
+    connect(m_debounceTimer, &QTimer::timeout, this, &AudioStreams::flushPending);
+
+    m_summaryTimer->setSingleShot(true);
+    m_summaryTimer->setInterval(0);
+    connect(m_summaryTimer, &QTimer::timeout, this, &AudioStreams::updateSummary);
+
+    connect(m_ctx, &PulseAudioQt::Context::sinkInputAdded, this, &AudioStreams::onStreamAdded);
+    connect(m_ctx, &PulseAudioQt::Context::sinkInputRemoved, this, &AudioStreams::onStreamRemoved);
+    for (auto *stream : m_ctx->sinkInputs())
+        onStreamAdded(stream);
+}
+
+void AudioStreams::onStreamAdded(PulseAudioQt::SinkInput *stream)
+{
+    // Event sounds and virtual streams come and go constantly, they are not applications
+    if (stream->isVirtualStream())
+        return;
+    if (stream->properties().value(QStringLiteral("media.role")).toString() == QLatin1String("event"))
+        return;
+
+    m_pendingRemoved.remove(stream->index());
+    m_pendingAdded.insert(stream->index(), stream);
+    if (!m_debounceTimer->isActive())
+        m_debounceTimer->start();
+}
+
+void AudioStreams::onStreamRemoved(PulseAudioQt::SinkInput *stream)
+{
+    const quint32 index = stream->index();
+    // Added and removed within the same window, HA never needs to hear about it
+    if (m_pendingAdded.remove(index))
+        return;
+    if (!m_streams.contains(index))
+        return;
+    m_pendingRemoved.insert(index);
+    if (!m_debounceTimer->isActive())
+        m_debounceTimer->start();
+}
+
+void AudioStreams::flushPending()
+{
+    for (quint32 index : std::as_const(m_pendingRemoved)) {
+        if (auto *entities = m_streams.take(index)) {
+            entities->unRegister();
+            entities->deleteLater();
+        }
+    }
+    m_pendingRemoved.clear();
+
+    for (auto it = m_pendingAdded.constBegin(); it != m_pendingAdded.constEnd(); ++it) {
+        if (!it.value() || m_streams.contains(it.key()))
+            continue;
+        auto *entities = new AudioStreamEntities(it.value(), this);
+        connect(entities, &AudioStreamEntities::changed, m_summaryTimer, qOverload<>(&QTimer::start));
+        m_streams.insert(it.key(), entities);
+    }
+    m_pendingAdded.clear();
+
+    qCDebug(audio) << "Tracking" << m_streams.size() << "application streams";
+    updateSummary();
+}
+
+void AudioStreams::updateSummary()
+{
+    QVariantList applications;
+    int playing = 0;
+    for (auto *entities : std::as_const(m_streams)) {
+        const PulseAudioQt::SinkInput *stream = entities->stream();
+        if (!stream)
+            continue;
+        QVariantMap app;
+        app["name"] = streamApplicationName(stream);
+        app["media"] = stream->name();
+        app["pid"] = stream->properties().value(QStringLiteral("application.process.id")).toString();
+        app["volume"] = paToPercent(stream->volume());
+        app["muted"] = stream->isMuted();
+        app["playing"] = !stream->isCorked();
+        applications.append(app);
+        if (!stream->isCorked())
+            ++playing;
+    }
+
+    const QString state = QString::number(playing);
+    if (m_summary->state() != state)
+        m_summary->setState(state);
+    QVariantMap attributes;
+    attributes["applications"] = applications;
+    if (m_summary->attributes() != attributes)
+        m_summary->setAttributes(attributes);
+}
+
 class Audio : public QObject
 {
     Q_OBJECT
@@ -28,6 +433,10 @@ public:
 private slots:
     void updateSinks();
     void updateSources();
+    void onSinkAdded(PulseAudioQt::Sink *sink);
+    void onSinkRemoved(PulseAudioQt::Sink *sink);
+    void onSourceAdded(PulseAudioQt::Source *source);
+    void onSourceRemoved(PulseAudioQt::Source *source);
     void onSinkSelected(const QString &newOption);
     void onSourceSelected(const QString &newOption);
     void onSourceVolumeChanged();
@@ -39,11 +448,12 @@ private slots:
 
 private:
     bool checkIfRaiseMaxVolumeEnabled();
+    void onParcConfigChanged();
+    void applyMaximumVolume();
     bool raiseMaximumVolumeEnabled = false;
-    int paToPercent(qint64 v) const;
-    qint64 percentToPa(int percent) const;
 
-    QFileSystemWatcher *watcher = nullptr;
+    KSharedConfig::Ptr m_parcConfig;
+    KConfigWatcher::Ptr m_parcWatcher;
     Number *m_sinkVolume = nullptr;
     Number *m_sourceVolume = nullptr;
     Select *m_sinkSelector = nullptr;
@@ -52,6 +462,11 @@ private:
     PulseAudioQt::Sink *m_sink = nullptr;
     PulseAudioQt::Source *m_source = nullptr;
     PulseAudioQt::Context *m_ctx = nullptr;
+
+    // Per device entities, keyed by the PulseAudio index
+    QHash<quint32, AudioDeviceEntities *> m_sinkEntities;
+    QHash<quint32, AudioDeviceEntities *> m_sourceEntities;
+    AudioStreams *m_streams = nullptr;
 };
 
 // Constructor
@@ -62,36 +477,51 @@ Audio::Audio(QObject *parent)
     m_sinkVolume->setId("output_volume");
     m_sinkVolume->setName("Output Volume");
     m_sinkVolume->setDiscoveryConfig("icon", "mdi:knob");
+
+    // Inside the flatpak sandbox the host's plasma-pa settings are read directly. KConfigWatcher only
+    // matches configs opened by name, there the file watch below has to do
+    if (KSandbox::isFlatpak()) {
+        m_parcConfig = KSharedConfig::openConfig(QDir::homePath() + "/.config/plasmaparc", KConfig::SimpleConfig);
+    } else {
+        m_parcConfig = KSharedConfig::openConfig(QStringLiteral("plasmaparc"));
+    }
     raiseMaximumVolumeEnabled = checkIfRaiseMaxVolumeEnabled();
     if (raiseMaximumVolumeEnabled)
         m_sinkVolume->setRange(0, 150, 1, "%");
     else
         m_sinkVolume->setRange(0, 100, 1, "%");
-    
+
+    m_sinkVolume->setCommandThrottle(s_volumeCommandThrottle);
     connect(m_sinkVolume, &Number::valueChangeRequested, this, &Audio::setSinkVolume);
 
-    QString configPath = QDir::homePath() + "/.config/plasmaparc";
-    if (QFile::exists(configPath))
-    {
-        watcher = new QFileSystemWatcher(this);
-        watcher->addPath(configPath);
-        connect(watcher, &QFileSystemWatcher::fileChanged, this, [this,configPath](const QString &){
-            if (!this->watcher->files().contains(configPath)) {
-                this->watcher->addPath(configPath);
-            }
-            if (QFile::exists(configPath)) {
-                raiseMaximumVolumeEnabled = checkIfRaiseMaxVolumeEnabled();
-                m_sinkVolume->setRange(0, raiseMaximumVolumeEnabled ? 150 : 100, 1, "%");
-                m_sinkVolume->runtimeRegistration();
-            }
-        });
-    }
+    m_parcWatcher = KConfigWatcher::create(m_parcConfig);
+    connect(m_parcWatcher.data(), &KConfigWatcher::configChanged, this, [this](const KConfigGroup &group, const QByteArrayList &names) {
+        if (group.name() == QLatin1String("General") && names.contains("RaiseMaximumVolume")) {
+            onParcConfigChanged();
+        }
+    });
+    // Edits by hand or without Notify don't reach KConfigWatcher
+    const QString parcPath = m_parcConfig->name().startsWith(QLatin1Char('/'))
+        ? m_parcConfig->name()
+        : QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation) + QStringLiteral("/plasmaparc");
+    // KConfig saves through a temporary file that is renamed over the old one, so watch the directory
+    const QString parcDir = parcPath.section(QLatin1Char('/'), 0, -2);
+    const QString parcFile = parcPath.section(QLatin1Char('/'), -1);
+    InotifyHub::self()->subscribe(parcDir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE, this, [this, parcFile](const inotify_event *event) {
+        // After an overflow we don't know what changed, just read it again
+        if (!(event->mask & IN_Q_OVERFLOW) && (!event->len || QString::fromLocal8Bit(event->name) != parcFile)) {
+            return;
+        }
+        m_parcConfig->reparseConfiguration();
+        onParcConfigChanged();
+    });
     m_sourceVolume = new Number(this);
     m_sourceVolume->setId("input_volume");
     m_sourceVolume->setName("Input Volume");
     m_sourceVolume->setDiscoveryConfig("icon", "mdi:microphone");
     m_sourceVolume->setRange(0, 100, 1, "%");
 
+    m_sourceVolume->setCommandThrottle(s_volumeCommandThrottle);
     connect(m_sourceVolume, &Number::valueChangeRequested, this, &Audio::setSourceVolume);
 
     m_ctx = PulseAudioQt::Context::instance();
@@ -100,11 +530,11 @@ Audio::Audio(QObject *parent)
         return;
     }
     // Connect to the events for sink added/removed
-    connect(m_ctx, &PulseAudioQt::Context::sinkAdded, this, &Audio::updateSinks);
-    connect(m_ctx, &PulseAudioQt::Context::sinkRemoved, this, &Audio::updateSinks);
+    connect(m_ctx, &PulseAudioQt::Context::sinkAdded, this, &Audio::onSinkAdded);
+    connect(m_ctx, &PulseAudioQt::Context::sinkRemoved, this, &Audio::onSinkRemoved);
     // Connect to the events for source added/removed
-    connect(m_ctx, &PulseAudioQt::Context::sourceAdded, this, &Audio::updateSources);
-    connect(m_ctx, &PulseAudioQt::Context::sourceRemoved, this, &Audio::updateSources);
+    connect(m_ctx, &PulseAudioQt::Context::sourceAdded, this, &Audio::onSourceAdded);
+    connect(m_ctx, &PulseAudioQt::Context::sourceRemoved, this, &Audio::onSourceRemoved);
 
     auto *server = m_ctx->server();
     if (!server) {
@@ -132,10 +562,70 @@ Audio::Audio(QObject *parent)
     // Connect to signal when default source changes
     connect(server, &PulseAudioQt::Server::defaultSourceChanged, this, &Audio::updateSources);
 
+    for (auto *sink : m_ctx->sinks())
+        onSinkAdded(sink);
+    for (auto *source : m_ctx->sources())
+        onSourceAdded(source);
+
+    m_streams = new AudioStreams(m_ctx, this);
+
     updateSinks();
     updateSources();
 }
 
+void Audio::onSinkAdded(PulseAudioQt::Sink *sink)
+{
+    if (!m_sinkEntities.contains(sink->index())) {
+        auto *entities = new AudioDeviceEntities(sink, "sink", raiseMaximumVolumeEnabled ? 150 : 100, this);
+        // Volume changes of the default sink are mirrored into the legacy output volume entity
+        connect(entities, &AudioDeviceEntities::changed, this, [this, sink]() {
+            if (sink == m_sink)
+                onSinkVolumeChanged();
+        });
+        m_sinkEntities.insert(sink->index(), entities);
+    }
+    if (m_sinkSelector)
+        updateSinks();
+}
+
+void Audio::onSinkRemoved(PulseAudioQt::Sink *sink)
+{
+    if (auto *entities = m_sinkEntities.take(sink->index())) {
+        entities->unRegister();
+        entities->deleteLater();
+    }
+    if (sink == m_sink)
+        m_sink = nullptr;
+    if (m_sinkSelector)
+        updateSinks();
+}
+
+void Audio::onSourceAdded(PulseAudioQt::Source *source)
+{
+    if (!isMonitorSource(source) && !m_sourceEntities.contains(source->index())) {
+        auto *entities = new AudioDeviceEntities(source, "source", 100, this);
+        connect(entities, &AudioDeviceEntities::changed, this, [this, source]() {
+            if (source == m_source)
+                onSourceVolumeChanged();
+        });
+        m_sourceEntities.insert(source->index(), entities);
+    }
+    if (m_sourceSelector)
+        updateSources();
+}
+
+void Audio::onSourceRemoved(PulseAudioQt::Source *source)
+{
+    if (auto *entities = m_sourceEntities.take(source->index())) {
+        entities->unRegister();
+        entities->deleteLater();
+    }
+    if (source == m_source)
+        m_source = nullptr;
+    if (m_sourceSelector)
+        updateSources();
+}
+
 void Audio::updateSinks()
 {
     auto sink = m_ctx->server()->defaultSink();
@@ -146,16 +636,11 @@ void Audio::updateSinks()
     if (options != m_sinkSelector->options())
         m_sinkSelector->setOptions(options);
 
-    // Disconnect from previous sink if any
-    if (m_sink) {
-        disconnect(m_sink, nullptr, this, nullptr);
-    }
-
+    // Volume changes reach us through the per device entities, no need to reconnect here
     m_sink = sink;
 
-    if (m_sink) {
+    if (m_sink && m_sink->description() != m_sinkSelector->state()) {
         m_sinkSelector->setState(m_sink->description());
-        connect(m_sink, &PulseAudioQt::VolumeObject::volumeChanged, this, &Audio::onSinkVolumeChanged);
     }
     onSinkVolumeChanged();
 }
@@ -171,16 +656,10 @@ void Audio::updateSources()
     if (options != m_sourceSelector->options())
         m_sourceSelector->setOptions(options);
 
-    // Disconnect from previous sink if any
-    if (m_source) {
-        disconnect(m_source, nullptr, this, nullptr);
-    }
-
     m_source = source;
 
-    if (m_source) {
+    if (m_source && m_source->description() != m_sourceSelector->state()) {
         m_sourceSelector->setState(m_source->description());
-        connect(m_source, &PulseAudioQt::VolumeObject::volumeChanged, this, &Audio::onSourceVolumeChanged);
     }
     onSourceVolumeChanged();
 }
@@ -223,16 +702,15 @@ void Audio::onSinkVolumeChanged()
     int percent = paToPercent(m_sink->volume());
     if (percent == m_sinkVolume->value())
         return;
+    // setRange only republishes discovery when the range actually changes
     int currentMax = m_sinkVolume->max();
     if(percent > 100 && currentMax == 100)
     {
         m_sinkVolume->setRange(0, 150, 1, "%");
-        m_sinkVolume->runtimeRegistration();
     }
     else if (percent <= 100 && currentMax == 150 && !raiseMaximumVolumeEnabled)
     {
         m_sinkVolume->setRange(0, 100, 1, "%");
-        m_sinkVolume->runtimeRegistration();       
     }
     if(percent > 150)
     {
@@ -280,35 +758,29 @@ void Audio::setSourceVolume(int v)
 }
 bool Audio::checkIfRaiseMaxVolumeEnabled()
 {
-    // Universal path til alle brukere
-    QString path = QStringLiteral("%1/.config/plasmaparc").arg(qgetenv("HOME"));
-    QFile file(path);
-
-    if (!file.exists() || !file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        return false; // fil finnes ikke eller kan ikke åpnes
-    }
-
-    QTextStream in(&file);
-    while (!in.atEnd()) {
-        QString line = in.readLine().trimmed();
-        if (line == QLatin1String("RaiseMaximumVolume=true")) {
-            return true;
-        }
-    }
-
-    return false;
+    // KConfigWatcher reparses the file before notifying us, the file watch does it itself
+    return m_parcConfig->group(QStringLiteral("General")).readEntry("RaiseMaximumVolume", false);
 }
-int Audio::paToPercent(qint64 v) const
+
+void Audio::onParcConfigChanged()
 {
-    double p = (double)v / PulseAudioQt::normalVolume() * 100.0;
-    return qRound(p);
+    const bool enabled = checkIfRaiseMaxVolumeEnabled();
+    if (enabled == raiseMaximumVolumeEnabled) {
+        return;
+    }
+    raiseMaximumVolumeEnabled = enabled;
+    applyMaximumVolume();
 }
 
-qint64 Audio::percentToPa(int percent) const
+void Audio::applyMaximumVolume()
 {
-    return qRound(PulseAudioQt::normalVolume() * (percent / 100.0));
+    const int max = raiseMaximumVolumeEnabled ? 150 : 100;
+    // Keep 150 while the volume is still above 100, onSinkVolumeChanged will lower it later
+    if (max == 150 || m_sinkVolume->value() <= 100)
+        m_sinkVolume->setRange(0, max, 1, "%");
+    for (auto *entities : std::as_const(m_sinkEntities))
+        entities->setMaximumVolume(max);
 }
-
 // Setup
 void setupAudio()
 {
@@ -0,0 +1,314 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "core.h"
+#include "entities/entities.h"
+
+#include <PulseAudioQt/Context>
+#include <PulseAudioQt/Server>
+#include <PulseAudioQt/Sink>
+
+#include <pulse/context.h>
+#include <pulse/proplist.h>
+#include <pulse/stream.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <cmath>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(audiolevel)
+Q_LOGGING_CATEGORY(audiolevel, "integration.AudioLevel")
+
+// Peak and mean square of a block of samples.
+// Kept branch free so the compiler can vectorise it, but with server side peak
+// detection we usually get a single sample per fragment anyway.
+static void measureBlock(const float *samples, size_t count, float &peak, float &meanSquare)
+{
+    float blockPeak = 0;
+    float sumSquares = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const float s = std::fabs(samples[i]);
+        blockPeak = s > blockPeak ? s : blockPeak;
+        sumSquares += s * s;
+    }
+    peak = blockPeak;
+    meanSquare = count ? sumSquares / count : 0;
+}
+
+class AudioLevel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AudioLevel(QObject *parent = nullptr);
+    ~AudioLevel();
+
+private:
+    static void readCallback(pa_stream *stream, size_t length, void *userdata);
+    static void stateCallback(pa_stream *stream, void *userdata);
+    void connectMonitor();
+    void disconnectMonitor();
+    void scheduleReconnect();
+    void processSamples(const float *samples, size_t count);
+    void publish();
+
+    PulseAudioQt::Context *m_ctx = nullptr;
+    pa_stream *m_stream = nullptr;
+    QString m_monitorName;
+
+    BinarySensor *m_playing = nullptr;
+    Sensor *m_level = nullptr;
+    QTimer *m_publishTimer = nullptr;
+    QTimer *m_reconnectTimer = nullptr;
+    int m_reconnectDelay = 0;
+    QElapsedTimer m_clock;
+
+    float m_windowPeak = 0;
+    float m_windowMeanSquare = 0;
+    int m_windowBlocks = 0;
+    qint64 m_lastLoudMs = -1;
+    int m_lastPublishedLevel = -1;
+    bool m_monitorChanged = false;
+};
+
+// Samples per second requested from the monitor stream, the server sends us the peak of each period
+static constexpr uint32_t s_sampleRate = 10;
+// Hysteresis gate, linear amplitude. Roughly -40 dBFS to switch on, -50 dBFS counts as quiet
+static constexpr float s_onThreshold = 0.01f;
+static constexpr float s_offThreshold = 0.003f;
+// How long it has to stay quiet before we report silence, bridges gaps between tracks
+static constexpr qint64 s_holdMs = 3000;
+// Backoff for reconnecting a monitor stream that ended, e.g. while the sound server restarts
+static constexpr int s_minReconnectDelay = 1000;
+static constexpr int s_maxReconnectDelay = 60 * 1000;
+
+AudioLevel::AudioLevel(QObject *parent)
+    : QObject(parent)
+    , m_publishTimer(new QTimer(this))
+    , m_reconnectTimer(new QTimer(this))
+    , m_reconnectDelay(s_minReconnectDelay)
+{
+    m_playing = new BinarySensor(this);
+    m_playing->setId("sound_playing");
+    m_playing->setName("Sound Playing");
+    m_playing->setDiscoveryConfig("device_class", "sound");
+    m_playing->setState(false);
+
+    m_level = new Sensor(this);
+    m_level->setId("sound_level");
+    m_level->setName("Sound Level");
+    m_level->setDiscoveryConfig("unit_of_measurement", "%");
+    m_level->setDiscoveryConfig("state_class", "measurement");
+    m_level->setDiscoveryConfig("icon", "mdi:waveform");
+    m_level->setState("0");
+
+    m_clock.start();
+
+    // Downsample to one publish per second
+    m_publishTimer->setInterval(1000);
+    connect(m_publishTimer, &QTimer::timeout, this, &AudioLevel::publish);
+
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &AudioLevel::connectMonitor);
+
+    m_ctx = PulseAudioQt::Context::instance();
+    if (!m_ctx || !m_ctx->isValid() || !m_ctx->server()) {
+        qCWarning(audiolevel) << "PulseAudio context not valid";
+        return;
+    }
+
+    connect(m_ctx->server(), &PulseAudioQt::Server::defaultSinkChanged, this, &AudioLevel::connectMonitor);
+    connectMonitor();
+}
+
+AudioLevel::~AudioLevel()
+{
+    disconnectMonitor();
+}
+
+void AudioLevel::connectMonitor()
+{
+    PulseAudioQt::Sink *sink = m_ctx->server()->defaultSink();
+    const QString monitorName = sink ? sink->name() + QStringLiteral(".monitor") : QString();
+    if (monitorName == m_monitorName && m_stream && pa_stream_get_state(m_stream) == PA_STREAM_READY) {
+        return;
+    }
+
+    disconnectMonitor();
+    if (monitorName != m_monitorName) {
+        m_monitorChanged = true;
+    }
+    m_monitorName = monitorName;
+    if (m_monitorName.isEmpty()) {
+        // No sink at all, defaultSinkChanged tells us when there is one again
+        return;
+    }
+    if (!m_ctx->context()) {
+        scheduleReconnect();
+        return;
+    }
+
+    pa_sample_spec spec;
+    spec.channels = 1;
+    spec.format = PA_SAMPLE_FLOAT32;
+    spec.rate = s_sampleRate;
+
+    pa_buffer_attr attr = {};
+    attr.maxlength = static_cast<uint32_t>(-1);
+    attr.fragsize = sizeof(float);
+
+    // Tag the stream so other watchers (and our own microphone sensor) can recognise it
+    pa_proplist *props = pa_proplist_new();
+    pa_proplist_sets(props, PA_PROP_APPLICATION_NAME, "kiot");
+    pa_proplist_sets(props, PA_PROP_APPLICATION_ID, "org.davidedmundson.kiot");
+    m_stream = pa_stream_new_with_proplist(m_ctx->context(), "Kiot Sound Level", &spec, nullptr, props);
+    pa_proplist_free(props);
+    if (!m_stream) {
+        qCWarning(audiolevel) << "Failed to create monitor stream";
+        scheduleReconnect();
+        return;
+    }
+
+    pa_stream_set_read_callback(m_stream, &AudioLevel::readCallback, this);
+    pa_stream_set_state_callback(m_stream, &AudioLevel::stateCallback, this);
+    const auto flags = static_cast<pa_stream_flags_t>(PA_STREAM_PEAK_DETECT | PA_STREAM_ADJUST_LATENCY | PA_STREAM_DONT_MOVE
+                                                      | PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND);
+    if (pa_stream_connect_record(m_stream, m_monitorName.toUtf8().constData(), &attr, flags) < 0) {
+        qCWarning(audiolevel) << "Failed to connect monitor stream to" << m_monitorName;
+        disconnectMonitor();
+        scheduleReconnect();
+        return;
+    }
+    m_publishTimer->start();
+    qCDebug(audiolevel) << "Monitoring" << m_monitorName;
+}
+
+void AudioLevel::disconnectMonitor()
+{
+    if (!m_stream) {
+        return;
+    }
+    pa_stream_set_read_callback(m_stream, nullptr, nullptr);
+    pa_stream_set_state_callback(m_stream, nullptr, nullptr);
+    pa_stream_disconnect(m_stream);
+    pa_stream_unref(m_stream);
+    m_stream = nullptr;
+    m_publishTimer->stop();
+}
+
+void AudioLevel::readCallback(pa_stream *stream, size_t, void *userdata)
+{
+    auto *self = static_cast<AudioLevel *>(userdata);
+    const void *data = nullptr;
+    size_t length = 0;
+
+    while (pa_stream_readable_size(stream) > 0) {
+        if (pa_stream_peek(stream, &data, &length) < 0) {
+            return;
+        }
+        if (data) {
+            self->processSamples(static_cast<const float *>(data), length / sizeof(float));
+        }
+        // a hole in the stream (data == nullptr) still needs dropping when length is set
+        if (length) {
+            pa_stream_drop(stream);
+        }
+    }
+}
+
+void AudioLevel::scheduleReconnect()
+{
+    if (m_reconnectTimer->isActive()) {
+        return;
+    }
+    qCDebug(audiolevel) << "Reconnecting monitor stream in" << m_reconnectDelay << "ms";
+    m_reconnectTimer->start(m_reconnectDelay);
+    m_reconnectDelay = qMin(m_reconnectDelay * 2, s_maxReconnectDelay);
+}
+
+void AudioLevel::stateCallback(pa_stream *stream, void *userdata)
+{
+    auto *self = static_cast<AudioLevel *>(userdata);
+    const pa_stream_state_t state = pa_stream_get_state(stream);
+    if (state == PA_STREAM_READY) {
+        self->m_reconnectDelay = s_minReconnectDelay;
+        return;
+    }
+    if (state != PA_STREAM_FAILED && state != PA_STREAM_TERMINATED) {
+        return;
+    }
+    // The sink went away or the server restarted. Not torn down from within the stream's own
+    // callback. A default sink change reconnects right away, otherwise we retry with a backoff
+    qCDebug(audiolevel) << "Monitor stream of" << self->m_monitorName << "ended";
+    QMetaObject::invokeMethod(
+        self,
+        [self, stream]() {
+            if (self->m_stream != stream) {
+                return;
+            }
+            self->disconnectMonitor();
+            // Nothing is measured until then, don't leave the last values standing
+            self->m_playing->setState(false);
+            self->m_lastPublishedLevel = 0;
+            self->m_level->setState(QStringLiteral("0"));
+            self->scheduleReconnect();
+        },
+        Qt::QueuedConnection);
+}
+
+void AudioLevel::processSamples(const float *samples, size_t count)
+{
+    float peak = 0;
+    float meanSquare = 0;
+    measureBlock(samples, count, peak, meanSquare);
+
+    m_windowPeak = std::max(m_windowPeak, peak);
+    m_windowMeanSquare += meanSquare;
+    ++m_windowBlocks;
+
+    if (peak >= s_offThreshold) {
+        m_lastLoudMs = m_clock.elapsed();
+    }
+    // Switching on is immediate, switching off waits for the hold time in publish()
+    if (peak >= s_onThreshold && !m_playing->state()) {
+        m_playing->setState(true);
+    }
+}
+
+void AudioLevel::publish()
+{
+    // A suspended sink stops delivering samples altogether, so silence is also detected here
+    if (m_playing->state() && (m_lastLoudMs < 0 || m_clock.elapsed() - m_lastLoudMs > s_holdMs)) {
+        m_playing->setState(false);
+    }
+
+    const int level = qRound(qMin(m_windowPeak, 1.0f) * 100);
+    QVariantMap attributes;
+    if (m_windowBlocks > 0) {
+        const double rms = std::sqrt(m_windowMeanSquare / m_windowBlocks);
+        attributes["rms"] = qRound(rms * 100);
+    }
+    m_windowPeak = 0;
+    m_windowMeanSquare = 0;
+    m_windowBlocks = 0;
+
+    if (level == m_lastPublishedLevel && !m_monitorChanged) {
+        return;
+    }
+    m_lastPublishedLevel = level;
+    m_monitorChanged = false;
+    m_level->setState(QString::number(level));
+    attributes["device"] = m_monitorName;
+    m_level->setAttributes(attributes);
+}
+
+void setupAudioLevel()
+{
+    new AudioLevel(qApp);
+}
+
+REGISTER_INTEGRATION("AudioLevel", setupAudioLevel, false)
+
+#include "audiolevel.moc"
@@ -9,6 +9,16 @@
 #include <Solid/DeviceInterface>
 #include <Solid/DeviceNotifier>
 
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTimer>
+
+#include <array>
+#include <cmath>
+
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(batter)
 Q_LOGGING_CATEGORY(batter, "integration.Battery")
@@ -89,29 +99,235 @@ static QString mapChargeState(Solid::Battery::ChargeState state)
     }
 }
 
+// Constant memory history of (timestamp, energy) samples for one battery.
+// UPower's own time estimates follow the instantaneous rate and swing wildly,
+// so we derive a smoothed power draw from the energy readings ourselves.
+class BatteryHistory
+{
+public:
+    void addSample(qint64 timestampMs, double energyWh);
+    void clear();
+    // Exponentially weighted power draw in W, positive while discharging.
+    // Fed with the rate across the whole buffer, consecutive samples are too coarse on their own
+    double rate() const
+    {
+        return m_rate;
+    }
+    bool hasRate() const
+    {
+        return m_hasRate;
+    }
+    // Average power draw across everything still in the buffer
+    double windowRate() const;
+    int sampleCount() const
+    {
+        return m_count;
+    }
+
+private:
+    struct Sample {
+        qint64 timestampMs = 0;
+        double energyWh = 0;
+    };
+    static constexpr int s_capacity = 32;
+    static constexpr qint64 s_minIntervalMs = 10 * 1000;
+    static constexpr double s_timeConstantSecs = 300;
+
+    const Sample &newest() const
+    {
+        return m_samples[(m_head + s_capacity - 1) % s_capacity];
+    }
+    const Sample &oldest() const
+    {
+        return m_samples[(m_head + s_capacity - m_count) % s_capacity];
+    }
+
+    std::array<Sample, s_capacity> m_samples;
+    int m_head = 0; // next slot to write
+    int m_count = 0;
+    double m_rate = 0;
+    bool m_hasRate = false;
+};
+
+void BatteryHistory::addSample(qint64 timestampMs, double energyWh)
+{
+    if (m_count > 0) {
+        const Sample &previous = newest();
+        const qint64 elapsedMs = timestampMs - previous.timestampMs;
+        // Several properties change per UPower refresh, only keep one sample per refresh
+        if (elapsedMs < s_minIntervalMs) {
+            return;
+        }
+    }
+
+    m_samples[m_head] = {timestampMs, energyWh};
+    m_head = (m_head + 1) % s_capacity;
+    m_count = qMin(m_count + 1, s_capacity);
+    if (m_count < 2) {
+        return;
+    }
+
+    const double windowedRate = windowRate();
+    if (m_hasRate) {
+        const double elapsedSecs = (timestampMs - m_samples[(m_head + s_capacity - 2) % s_capacity].timestampMs) / 1000.0;
+        const double alpha = 1.0 - std::exp(-elapsedSecs / s_timeConstantSecs);
+        m_rate += alpha * (windowedRate - m_rate);
+    } else {
+        m_rate = windowedRate;
+        m_hasRate = true;
+    }
+}
+
+void BatteryHistory::clear()
+{
+    m_head = 0;
+    m_count = 0;
+    m_rate = 0;
+    m_hasRate = false;
+}
+
+double BatteryHistory::windowRate() const
+{
+    if (m_count < 2) {
+        return 0;
+    }
+    const double elapsedSecs = (newest().timestampMs - oldest().timestampMs) / 1000.0;
+    if (elapsedSecs <= 0) {
+        return 0;
+    }
+    return (oldest().energyWh - newest().energyWh) * 3600.0 / elapsedSecs;
+}
+
+// Numeric sensor that only republishes when the value moved by more than its deadband
+struct DeadbandSensor {
+    Sensor *sensor = nullptr;
+    double deadband = 0;
+    int precision = 0;
+    double lastValue = 0;
+    bool hasValue = false;
+
+    void setValue(double value)
+    {
+        if (hasValue && std::abs(value - lastValue) < deadband) {
+            return;
+        }
+        lastValue = value;
+        hasValue = true;
+        sensor->setState(QString::number(value, 'f', precision));
+    }
+    void setUnknown()
+    {
+        if (!hasValue && sensor->state() == QLatin1String("None")) {
+            return;
+        }
+        hasValue = false;
+        // HA treats a "None" payload as unknown
+        sensor->setState(QStringLiteral("None"));
+    }
+};
+
+// Energy is only saved once this much more was discharged, or on exit
+static constexpr double s_dischargeSaveStepWh = 1.0;
+
+// The kernel's cycle count, for UPower batteries backed by a power supply in sysfs. -1 if unknown
+static int kernelCycleCount(const QString &udi)
+{
+    // e.g. /org/freedesktop/UPower/devices/battery_BAT0
+    const QString object = udi.section(QLatin1Char('/'), -1);
+    if (!object.startsWith(QLatin1String("battery_"))) {
+        return -1;
+    }
+    QFile file(QStringLiteral("/sys/class/power_supply/") + object.mid(8) + QStringLiteral("/cycle_count"));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    bool ok = false;
+    const int cycles = file.readAll().trimmed().toInt(&ok);
+    // Many firmwares report 0 when they don't count
+    return ok && cycles > 0 ? cycles : -1;
+}
+
 class BatteryWatcher : public QObject
 {
     Q_OBJECT
 public:
     explicit BatteryWatcher(QObject *parent = nullptr);
+    ~BatteryWatcher();
 
 private slots:
     void deviceAdded(const QString &udi);
     void deviceRemoved(const QString &udi);
 
 private:
+    // Everything we need to publish a battery, resolved once at registration
+    struct BatteryEntry {
+        Solid::Device device; // keeps the backend object behind battery alive
+        Solid::Battery *battery = nullptr;
+        Sensor *sensor = nullptr;
+        int lastChargePercent = -1;
+        bool dirty = false;
+
+        // Analytics, only for batteries reporting energy
+        bool hasAnalytics = false;
+        BatteryHistory history;
+        int lastChargeState = -1;
+        DeadbandSensor powerSensor;
+        DeadbandSensor timeRemainingSensor;
+        DeadbandSensor healthSensor;
+        // For the cycle estimate, energy discharged since kiot first saw the battery
+        QString stateKey;
+        double dischargedWh = 0;
+        double savedDischargedWh = 0;
+        double lastEnergy = -1;
+        // Read from sysfs once and again when energy full changes, which is when a cycle shows
+        int kernelCycles = -1;
+        double cyclesEnergyFull = -1;
+    };
+
     void setupSolidWatching();
     void registerBattery(const QString &udi);
-    void updateBatteryAttributes(const QString &udi);
-    QHash<QString, Sensor *> m_udiToSensor;
+    void markDirty(const QString &udi);
+    void flushDirty();
+    void updateBattery(const QString &udi, BatteryEntry &entry);
+    void setupAnalytics(BatteryEntry &entry, const QString &id, const QString &name);
+    void updateAnalytics(BatteryEntry &entry);
+    void saveDischarged(BatteryEntry &entry);
+    QHash<QString, BatteryEntry> m_batteries;
+    QTimer *m_flushTimer = nullptr;
+    QElapsedTimer m_clock;
 };
 
 BatteryWatcher::BatteryWatcher(QObject *parent)
     : QObject(parent)
+    , m_flushTimer(new QTimer(this))
 {
+    // UPower refreshes arrive as a burst of property signals, publish once per event loop turn
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(0);
+    connect(m_flushTimer, &QTimer::timeout, this, &BatteryWatcher::flushDirty);
+    m_clock.start();
+
     setupSolidWatching();
 }
 
+BatteryWatcher::~BatteryWatcher()
+{
+    for (auto &entry : m_batteries) {
+        if (entry.hasAnalytics)
+            saveDischarged(entry);
+    }
+}
+
+void BatteryWatcher::saveDischarged(BatteryEntry &entry)
+{
+    if (entry.dischargedWh == entry.savedDischargedWh)
+        return;
+    KConfigGroup group = KSharedConfig::openStateConfig()->group(QStringLiteral("BatteryDischarged"));
+    group.writeEntry(entry.stateKey, entry.dischargedWh);
+    group.sync();
+    entry.savedDischargedWh = entry.dischargedWh;
+}
+
 void BatteryWatcher::setupSolidWatching()
 {
     // Watch for device changes
@@ -137,29 +353,41 @@ void BatteryWatcher::deviceAdded(const QString &udi)
 
 void BatteryWatcher::deviceRemoved(const QString &udi)
 {
-    auto it = m_udiToSensor.find(udi);
-    if (it != m_udiToSensor.end()) {
+    auto it = m_batteries.find(udi);
+    if (it != m_batteries.end()) {
         qCDebug(batter) << "Battery removed:" << udi;
         // TODO find a way to set sensor as unavailable when battery disconnects so HA shows the correct state of the battery
-        it.value()->deleteLater();
-        m_udiToSensor.erase(it);
+        disconnect(it->battery, nullptr, this, nullptr);
+        it->sensor->deleteLater();
+        if (it->hasAnalytics) {
+            saveDischarged(it.value());
+            it->powerSensor.sensor->deleteLater();
+            it->timeRemainingSensor.sensor->deleteLater();
+            it->healthSensor.sensor->deleteLater();
+        }
+        m_batteries.erase(it);
     }
 }
 
 void BatteryWatcher::registerBattery(const QString &udi)
 {
-    Solid::Device device(udi);
-    Solid::Battery *battery = device.as<Solid::Battery>();
+    if (m_batteries.contains(udi)) {
+        return;
+    }
+
+    BatteryEntry entry;
+    entry.device = Solid::Device(udi);
+    entry.battery = entry.device.as<Solid::Battery>();
 
-    if (!battery) {
+    if (!entry.battery) {
         qCWarning(batter) << "Device is not a battery:" << udi;
         return;
     }
-    QString udi_e = udi;
+    Solid::Battery *battery = entry.battery;
     // Create display name
-    QString name = device.displayName();
+    QString name = entry.device.displayName();
     if (name.isEmpty()) {
-        name = device.vendor() + " " + device.product();
+        name = entry.device.vendor() + " " + entry.device.product();
     }
     if (name.trimmed().isEmpty()) {
         name = "Battery " + udi.split('/').last();
@@ -169,52 +397,63 @@ void BatteryWatcher::registerBattery(const QString &udi)
     Sensor *sensor = new Sensor(this);
     sensor->setDiscoveryConfig("device_class", "battery");
     sensor->setDiscoveryConfig("unit_of_measurement", "%");
-    sensor->setId("battery_" + name.replace(' ', '_'));
+    const QString id = "battery_" + QString(name).replace(' ', '_');
+    sensor->setId(id);
     sensor->setName(name);
+    entry.sensor = sensor;
+
+    // Peripheral batteries only report a percentage, nothing to derive rates from
+    if (battery->energyFullDesign() > 0 || battery->energy() > 0) {
+        setupAnalytics(entry, id, name);
+    }
+
+    // Connect to battery signals, they only mark the battery dirty
+    auto dirty = [this, udi]() {
+        markDirty(udi);
+    };
+    connect(battery, &Solid::Battery::chargePercentChanged, this, dirty);
+    connect(battery, &Solid::Battery::chargeStateChanged, this, dirty);
+    connect(battery, &Solid::Battery::energyChanged, this, dirty);
+    connect(battery, &Solid::Battery::energyRateChanged, this, dirty);
+    connect(battery, &Solid::Battery::voltageChanged, this, dirty);
+    connect(battery, &Solid::Battery::temperatureChanged, this, dirty);
+    connect(battery, &Solid::Battery::timeToEmptyChanged, this, dirty);
+    connect(battery, &Solid::Battery::timeToFullChanged, this, dirty);
 
-    // Set initial state and attributes
-    sensor->setState(QString::number(battery->chargePercent()));
-
-    // Connect to battery signals
-    connect(battery, &Solid::Battery::chargePercentChanged, this, [this, udi](int) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::chargeStateChanged, this, [this, udi](int) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::energyChanged, this, [this, udi](double) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::energyRateChanged, this, [this, udi](double) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::voltageChanged, this, [this, udi](double) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::temperatureChanged, this, [this, udi](double) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::timeToEmptyChanged, this, [this, udi](qlonglong) {
-        updateBatteryAttributes(udi);
-    });
-    connect(battery, &Solid::Battery::timeToFullChanged, this, [this, udi](qlonglong) {
-        updateBatteryAttributes(udi);
-    });
-
-    m_udiToSensor[udi] = sensor;
-    updateBatteryAttributes(udi);
+    auto it = m_batteries.insert(udi, entry);
+    updateBattery(udi, it.value());
     qCInfo(batter) << "Registered battery:" << name << "at" << battery->chargePercent() << "%";
 }
 
-void BatteryWatcher::updateBatteryAttributes(const QString &udi)
+void BatteryWatcher::markDirty(const QString &udi)
 {
-    auto it = m_udiToSensor.find(udi);
-    if (it == m_udiToSensor.end())
-        return;
-    Solid::Device device(udi);
-    Solid::Battery *battery = device.as<Solid::Battery>();
-    if (!battery)
+    auto it = m_batteries.find(udi);
+    if (it == m_batteries.end())
         return;
+    it->dirty = true;
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start();
+}
+
+void BatteryWatcher::flushDirty()
+{
+    for (auto it = m_batteries.begin(); it != m_batteries.end(); ++it) {
+        if (it->dirty) {
+            it->dirty = false;
+            updateBattery(it.key(), it.value());
+        }
+    }
+}
+
+void BatteryWatcher::updateBattery(const QString &udi, BatteryEntry &entry)
+{
+    Solid::Battery *battery = entry.battery;
+
+    const int chargePercent = battery->chargePercent();
+    if (chargePercent != entry.lastChargePercent) {
+        entry.lastChargePercent = chargePercent;
+        entry.sensor->setState(QString::number(chargePercent));
+    }
 
     QString chargeStateString = mapChargeState(battery->chargeState());
     QString batteryTypeString = mapBatteryType(battery->type());
@@ -238,12 +477,13 @@ void BatteryWatcher::updateBatteryAttributes(const QString &udi)
         attributes["temperature"] = battery->temperature();
     if (battery->voltage() > 0)
         attributes["voltage"] = battery->voltage();
-    if (!device.product().isEmpty())
-        attributes["product"] = device.product();
-    if (!device.vendor().isEmpty())
-        attributes["vendor"] = device.vendor();
-    if (!device.as<Solid::Battery>()->serial().isEmpty())
-        attributes["serial"] = device.as<Solid::Battery>()->serial();
+    if (!entry.device.product().isEmpty())
+        attributes["product"] = entry.device.product();
+    if (!entry.device.vendor().isEmpty())
+        attributes["vendor"] = entry.device.vendor();
+    const QString serial = battery->serial();
+    if (!serial.isEmpty())
+        attributes["serial"] = serial;
     attributes["plugged_in"] = battery->isPowerSupply();
 
     // Add time estimates if available
@@ -257,7 +497,115 @@ void BatteryWatcher::updateBatteryAttributes(const QString &udi)
         attributes["time_to_full_hours"] = QString::number(battery->timeToFull() / 3600.0, 'f', 1);
     }
 
-    it.value()->setAttributes(attributes);
+    if (entry.sensor->attributes() != attributes)
+        entry.sensor->setAttributes(attributes);
+
+    if (entry.hasAnalytics)
+        updateAnalytics(entry);
+}
+
+void BatteryWatcher::setupAnalytics(BatteryEntry &entry, const QString &id, const QString &name)
+{
+    entry.hasAnalytics = true;
+
+    Sensor *power = new Sensor(this);
+    power->setId(id + "_power");
+    power->setName(name + " Discharge Rate");
+    power->setDiscoveryConfig("device_class", "power");
+    power->setDiscoveryConfig("state_class", "measurement");
+    power->setDiscoveryConfig("unit_of_measurement", "W");
+    entry.powerSensor = {power, 0.5, 1};
+
+    Sensor *timeRemaining = new Sensor(this);
+    timeRemaining->setId(id + "_time_remaining");
+    timeRemaining->setName(name + " Time Remaining");
+    timeRemaining->setDiscoveryConfig("device_class", "duration");
+    timeRemaining->setDiscoveryConfig("unit_of_measurement", "min");
+    timeRemaining->setDiscoveryConfig("icon", "mdi:timer-sand");
+    entry.timeRemainingSensor = {timeRemaining, 5, 0};
+
+    Sensor *health = new Sensor(this);
+    health->setId(id + "_health");
+    health->setName(name + " Health");
+    health->setDiscoveryConfig("unit_of_measurement", "%");
+    health->setDiscoveryConfig("icon", "mdi:battery-heart-variant");
+    entry.healthSensor = {health, 0.5, 1};
+
+    // Serial and id together, a replaced battery starts counting from zero
+    entry.stateKey = id + "_" + entry.battery->serial();
+    entry.dischargedWh = KSharedConfig::openStateConfig()->group(QStringLiteral("BatteryDischarged")).readEntry(entry.stateKey, 0.0);
+    entry.savedDischargedWh = entry.dischargedWh;
+}
+
+void BatteryWatcher::updateAnalytics(BatteryEntry &entry)
+{
+    Solid::Battery *battery = entry.battery;
+    const int chargeState = battery->chargeState();
+
+    // The rate flips sign when the charger is plugged or unplugged, old samples are useless after that
+    if (chargeState != entry.lastChargeState) {
+        entry.lastChargeState = chargeState;
+        entry.history.clear();
+    }
+
+    const double energy = battery->energy();
+    const double energyFull = battery->energyFull();
+    if (energy > 0) {
+        entry.history.addSample(m_clock.elapsed(), energy);
+        if (chargeState == Solid::Battery::Discharging && entry.lastEnergy > energy) {
+            entry.dischargedWh += entry.lastEnergy - energy;
+            if (entry.dischargedWh - entry.savedDischargedWh >= s_dischargeSaveStepWh)
+                saveDischarged(entry);
+        }
+        entry.lastEnergy = energy;
+    }
+
+    const BatteryHistory &history = entry.history;
+    if (history.hasRate()) {
+        entry.powerSensor.setValue(history.rate());
+    } else {
+        entry.powerSensor.setUnknown();
+    }
+
+    // Smoothed time to empty or time to full, depending on which way we are going
+    if (history.hasRate() && chargeState == Solid::Battery::Discharging && history.rate() > 0) {
+        entry.timeRemainingSensor.setValue(energy / history.rate() * 60.0);
+    } else if (history.hasRate() && chargeState == Solid::Battery::Charging && history.rate() < 0 && energyFull > energy) {
+        entry.timeRemainingSensor.setValue((energyFull - energy) / -history.rate() * 60.0);
+    } else {
+        entry.timeRemainingSensor.setUnknown();
+    }
+
+    QVariantMap timeAttributes;
+    timeAttributes["mode"] = mapChargeState(battery->chargeState());
+    timeAttributes["samples"] = history.sampleCount();
+    timeAttributes["window_rate"] = QString::number(history.windowRate(), 'f', 2);
+    if (entry.timeRemainingSensor.sensor->attributes() != timeAttributes)
+        entry.timeRemainingSensor.sensor->setAttributes(timeAttributes);
+
+    const double energyFullDesign = battery->energyFullDesign();
+    if (energyFull > 0 && energyFullDesign > 0) {
+        entry.healthSensor.setValue(energyFull / energyFullDesign * 100.0);
+
+        QVariantMap healthAttributes;
+        healthAttributes["energy_full"] = energyFull;
+        healthAttributes["energy_full_design"] = energyFullDesign;
+        healthAttributes["wear"] = QString::number(100.0 - energyFull / energyFullDesign * 100.0, 'f', 1);
+        // Prefer the battery's own count, otherwise full discharges worth of energy seen by kiot
+        if (energyFull != entry.cyclesEnergyFull) {
+            entry.cyclesEnergyFull = energyFull;
+            entry.kernelCycles = kernelCycleCount(entry.device.udi());
+        }
+        if (entry.kernelCycles > 0) {
+            healthAttributes["cycle_count"] = entry.kernelCycles;
+            healthAttributes["cycle_count_source"] = QStringLiteral("battery");
+        } else {
+            healthAttributes["cycle_count"] = QString::number(entry.dischargedWh / energyFull, 'f', 1);
+            healthAttributes["cycle_count_source"] = QStringLiteral("estimated");
+        }
+        if (entry.healthSensor.sensor->attributes() != healthAttributes)
+            entry.healthSensor.sensor->setAttributes(healthAttributes);
+    }
 }
 
 void setupBattery()
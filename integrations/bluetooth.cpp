@@ -10,6 +10,15 @@
 #include <BluezQt/InitManagerJob>
 #include <BluezQt/Manager>
 
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <algorithm>
+#include <limits>
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(bt)
 Q_LOGGING_CATEGORY(bt, "integration.Bluetooth")
@@ -19,31 +28,27 @@ class BluetoothDeviceSwitch : public QObject
 {
     Q_OBJECT
 public:
-    explicit BluetoothDeviceSwitch(const BluezQt::DevicePtr &device, QObject *parent = nullptr)
-    : QObject(parent), m_device(device)
+    explicit BluetoothDeviceSwitch(const BluezQt::DevicePtr &device, const QString &idPrefix, QObject *parent = nullptr)
+    : QObject(parent), m_device(device), m_updateTimer(new QTimer(this))
     {
         m_switch = new Switch(this);
-        m_switch->setId("bluetooth_device_" + device->address().replace(':', '_'));
+        m_switch->setId(idPrefix + device->address().replace(':', '_'));
         m_switch->setName(device->name());
         m_switch->setDiscoveryConfig("icon","mdi:bluetooth");  
         update();
 
-        // Connect signals
-        connect(device.data(), &BluezQt::Device::connectedChanged, this, [this](bool){
-            update();
-        });
-        connect(device.data(), &BluezQt::Device::batteryChanged, this, [this](QSharedPointer<BluezQt::Battery>){            
-            update();
-        });
-        connect(device.data(), &BluezQt::Device::pairedChanged, this, [this](bool){
-            update();
-        });
-        connect(device.data(), &BluezQt::Device::blockedChanged, this, [this](bool){
-            update();
-        });
-        connect(device.data(), &BluezQt::Device::trustedChanged, this, [this](bool){
-            update();
-        });
+        // BlueZ changes several properties at once on connect, update once per event loop turn
+        m_updateTimer->setSingleShot(true);
+        m_updateTimer->setInterval(0);
+        connect(m_updateTimer, &QTimer::timeout, this, &BluetoothDeviceSwitch::update);
+        auto scheduleUpdate = [this]() {
+            m_updateTimer->start();
+        };
+        connect(device.data(), &BluezQt::Device::connectedChanged, this, scheduleUpdate);
+        connect(device.data(), &BluezQt::Device::batteryChanged, this, scheduleUpdate);
+        connect(device.data(), &BluezQt::Device::pairedChanged, this, scheduleUpdate);
+        connect(device.data(), &BluezQt::Device::blockedChanged, this, scheduleUpdate);
+        connect(device.data(), &BluezQt::Device::trustedChanged, this, scheduleUpdate);
         // connect to signal from switch in HA        
         connect(m_switch, &Switch::stateChangeRequested, this, [this](bool requestedState){
             if (!m_device)
@@ -54,35 +59,33 @@ public:
                 m_device->disconnectFromDevice();
             }
         });
+        // Devices paired while we are running need registering on their own
+        m_switch->runtimeRegistration();
         qCInfo(bt) << "Bluetooth device added: " << device->name() << " (" << device->address() << ")";
     }
 
+    void unRegister()
+    {
+        m_switch->unRegister();
+    }
+
 private:
     BluezQt::DevicePtr m_device;
     Switch *m_switch = nullptr;
+    QTimer *m_updateTimer = nullptr;
 
 
     void update()
     {
         if (!m_device) return;
-        if(!m_device->isPaired()){
-            // TODO set entity as unavailable in HA and delete this
-            qCDebug(bt) << m_device->name() << " is not paired anymore";
-            m_switch->setState(false);
-        }
-        //Only update state and icon if actually changed to avoid unnecessary re registreations with mqtt
-        if(m_device->isConnected() && !m_switch->state())
-        {
-            m_switch->setHaIcon("mdi:bluetooth");
-            m_switch->setState(true);
-        }
-        else if(!m_device->isConnected() && m_switch->state()) 
-        {
-            m_switch->setHaIcon("mdi:bluetooth-off");
-            m_switch->setState(false);
-        }
+        //Only update state if actually changed, the icon follows as an attribute so discovery is untouched.
+        //HA drops an "icon" attribute, hence state_icon
+        if (m_device->isConnected() != m_switch->state())
+            m_switch->setState(m_device->isConnected());
+
         //Update attributes
         QVariantMap attrs;
+        attrs["state_icon"] = m_device->isConnected() ? "mdi:bluetooth-connect" : "mdi:bluetooth-off";
         attrs["mac"] = m_device->address();
         attrs["rssi"] = m_device->rssi();
         // Re add after bluez-qt works on new version via flatpak manifest
@@ -100,138 +103,272 @@ private:
 };
 
 
+// ==== Nearby devices code ==========
+// Devices found while the adapter is discovering. BlueZ reports every advertisement
+// as an RSSI change, so samples are only aggregated here and published on a slow timer.
+class BluetoothNearbyDevices : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BluetoothNearbyDevices(QObject *parent = nullptr);
+    void deviceSeen(const BluezQt::DevicePtr &device);
+    void deviceGone(const QString &address);
+
+private:
+    struct Sighting {
+        QString name;
+        double rssi = 0;
+        int samples = 0;
+        qint64 lastSeenMs = 0;
+    };
+    void publish();
+
+    Sensor *m_sensor = nullptr;
+    QTimer *m_publishTimer = nullptr;
+    QElapsedTimer m_clock;
+    QHash<QString, Sighting> m_sightings;
+};
+
+// Publish at most this often, however busy the air is
+static constexpr int s_nearbyPublishInterval = 10 * 1000;
+// Forget devices that stopped advertising for this long
+static constexpr qint64 s_nearbyExpiryMs = 60 * 1000;
+// Smoothing for the RSSI average, advertisements are noisy
+static constexpr double s_rssiSmoothing = 0.3;
+// Only the strongest devices go into the attributes
+static constexpr int s_nearbyMaxListed = 20;
+
+BluetoothNearbyDevices::BluetoothNearbyDevices(QObject *parent)
+    : QObject(parent)
+    , m_publishTimer(new QTimer(this))
+{
+    m_sensor = new Sensor(this);
+    m_sensor->setId("bluetooth_nearby_devices");
+    m_sensor->setName("Bluetooth Nearby Devices");
+    m_sensor->setDiscoveryConfig("icon", "mdi:bluetooth-audio");
+    m_sensor->setDiscoveryConfig("state_class", "measurement");
+    m_sensor->setState("0");
+
+    m_clock.start();
+
+    // Not restarted on new samples, so a steady stream of advertisements can't starve it
+    m_publishTimer->setSingleShot(true);
+    m_publishTimer->setInterval(s_nearbyPublishInterval);
+    connect(m_publishTimer, &QTimer::timeout, this, &BluetoothNearbyDevices::publish);
+}
+
+void BluetoothNearbyDevices::deviceSeen(const BluezQt::DevicePtr &device)
+{
+    const qint16 rssi = device->rssi();
+    // BlueZ reports -32768 or 0 when it has no reading
+    if (rssi == 0 || rssi == std::numeric_limits<qint16>::min()) {
+        return;
+    }
+    Sighting &sighting = m_sightings[device->address()];
+    sighting.name = device->name();
+    sighting.rssi = sighting.samples ? sighting.rssi + s_rssiSmoothing * (rssi - sighting.rssi) : rssi;
+    ++sighting.samples;
+    sighting.lastSeenMs = m_clock.elapsed();
+
+    if (!m_publishTimer->isActive())
+        m_publishTimer->start();
+}
+
+void BluetoothNearbyDevices::deviceGone(const QString &address)
+{
+    if (m_sightings.remove(address) && !m_publishTimer->isActive())
+        m_publishTimer->start();
+}
+
+void BluetoothNearbyDevices::publish()
+{
+    const qint64 now = m_clock.elapsed();
+    for (auto it = m_sightings.begin(); it != m_sightings.end();) {
+        if (now - it->lastSeenMs > s_nearbyExpiryMs)
+            it = m_sightings.erase(it);
+        else
+            ++it;
+    }
+
+    QList<QPair<QString, Sighting>> sorted;
+    sorted.reserve(m_sightings.size());
+    for (auto it = m_sightings.cbegin(); it != m_sightings.cend(); ++it)
+        sorted.append({it.key(), it.value()});
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.rssi > b.second.rssi;
+    });
+
+    QVariantList devices;
+    for (const auto &[address, sighting] : std::as_const(sorted)) {
+        if (devices.size() >= s_nearbyMaxListed)
+            break;
+        QVariantMap entry;
+        entry["mac"] = address;
+        entry["name"] = sighting.name;
+        entry["rssi"] = qRound(sighting.rssi);
+        entry["samples"] = sighting.samples;
+        devices.append(entry);
+    }
+
+    QVariantMap attrs;
+    attrs["devices"] = devices;
+    const QString count = QString::number(m_sightings.size());
+    if (m_sensor->state() != count)
+        m_sensor->setState(count);
+    if (m_sensor->attributes() != attrs)
+        m_sensor->setAttributes(attrs);
+
+    // Keep expiring devices while anything is left to expire
+    if (!m_sightings.isEmpty())
+        m_publishTimer->start();
+}
+
+
 // ====== Bluetooth Adapter code ======
+// One per adapter. The adapter that was used before multi adapter support keeps its ids so
+// existing HA entities survive, other adapters get their address in every id. hciN names
+// depend on enumeration order and can move between adapters across reboots.
 class BluetoothAdapterWatcher : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit BluetoothAdapterWatcher(QObject *parent = nullptr);
-    
+    BluetoothAdapterWatcher(const BluezQt::AdapterPtr &adapter, bool legacyIds, BluetoothNearbyDevices *nearby, QObject *parent = nullptr);
+    void unRegister();
+    void unRegisterDevices();
+
 private:
     void update();
-    void CheckPairedState();
+    void onDeviceAdded(const BluezQt::DevicePtr &device);
+    void onDeviceRemoved(const BluezQt::DevicePtr &device);
+    void onPairedChanged(const BluezQt::DevicePtr &device);
+    void removeDeviceSwitch(const QString &key);
     Switch *m_switch = nullptr;
-    BluezQt::Manager *m_manager = nullptr;
+    QTimer *m_updateTimer = nullptr;
     BluezQt::AdapterPtr m_adapter;
-    bool m_initialized = false;
+    QString m_deviceIdPrefix;
+    // Only paired devices get a switch, keyed by address
     QMap<QString, BluetoothDeviceSwitch*> m_btSwitches;
+    BluetoothNearbyDevices *m_nearby = nullptr;
 };
 
-BluetoothAdapterWatcher::BluetoothAdapterWatcher(QObject *parent)
+BluetoothAdapterWatcher::BluetoothAdapterWatcher(const BluezQt::AdapterPtr &adapter, bool legacyIds, BluetoothNearbyDevices *nearby, QObject *parent)
     : QObject(parent)
+    , m_updateTimer(new QTimer(this))
+    , m_adapter(adapter)
+    , m_nearby(nearby)
 {
+    const QString addressId = adapter->address().remove(':').toLower();
+    m_deviceIdPrefix = legacyIds ? QStringLiteral("bluetooth_device_") : "bluetooth_" + addressId + "_device_";
+
     m_switch = new Switch(this);
-    m_switch->setId("bluetooth_adapter");
-    m_switch->setName("Bluetooth Adapter");
+    m_switch->setId(legacyIds ? QStringLiteral("bluetooth_adapter") : "bluetooth_adapter_" + addressId);
+    m_switch->setName(legacyIds ? QStringLiteral("Bluetooth Adapter") : "Bluetooth Adapter " + adapter->address());
     m_switch->setDiscoveryConfig("icon", "mdi:bluetooth");
-    m_manager = new BluezQt::Manager(this);
 
-    // create the init job
-    BluezQt::InitManagerJob *job = m_manager->init();
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(0);
+    connect(m_updateTimer, &QTimer::timeout, this, &BluetoothAdapterWatcher::update);
+    auto scheduleUpdate = [this]() {
+        m_updateTimer->start();
+    };
 
-    connect(job, &BluezQt::InitManagerJob::result, this, [this, job]() {
-        if (job->error()) {
-            qCWarning(bt) << "Bluez init failed:" << job->errorText();
-            m_switch->setState(false);
-            return;
-        }
+    update();
+    // connect to adapter signals for updates, coalesced into one update per event loop turn
+    connect(m_adapter.data(), &BluezQt::Adapter::poweredChanged, this, scheduleUpdate);
+    connect(m_adapter.data(), &BluezQt::Adapter::discoverableChanged, this, scheduleUpdate);
+    connect(m_adapter.data(), &BluezQt::Adapter::discoveringChanged, this, scheduleUpdate);
+    connect(m_adapter.data(), &BluezQt::Adapter::nameChanged, this, scheduleUpdate);
+    connect(m_adapter.data(), &BluezQt::Adapter::systemNameChanged, this, scheduleUpdate);
+    connect(m_adapter.data(), &BluezQt::Adapter::uuidsChanged, this, scheduleUpdate);
 
-        auto adapters = job->manager()->adapters();
-        if (!adapters.isEmpty()) {
-            m_adapter = adapters.first(); // Use first adapter, could probably be customized from config but who has more than 1 bt adapter?
-            m_initialized = true;
-            update();
-            // connect to adapter signals for updates
-            connect(m_adapter.data(), &BluezQt::Adapter::poweredChanged, this, &BluetoothAdapterWatcher::update);
-            connect(m_adapter.data(), &BluezQt::Adapter::discoverableChanged, this, &BluetoothAdapterWatcher::update);
-            connect(m_adapter.data(), &BluezQt::Adapter::discoveringChanged, this, &BluetoothAdapterWatcher::update);
-            connect(m_adapter.data(), &BluezQt::Adapter::nameChanged, this, &BluetoothAdapterWatcher::update);
-            connect(m_adapter.data(), &BluezQt::Adapter::systemNameChanged, this, &BluetoothAdapterWatcher::update);
-            connect(m_adapter.data(), &BluezQt::Adapter::uuidsChanged, this, &BluetoothAdapterWatcher::update);
-
-              
-            // TODO figure out if its a better way to do this check for new/removed paired devices. 
-            // I tested deviceAdded and deviceRemoved but was not what i expected
-            connect(m_adapter.data(), &BluezQt::Adapter::deviceAdded, this, [this]() {
-                CheckPairedState();
-                update();
-            });
-            connect(m_adapter.data(), &BluezQt::Adapter::deviceRemoved, this, [this]() {
-                CheckPairedState();
-                update();
-            });
-            
-            // Add all paired devices 
-            // could probably use the CheckPairedState function here now
-            for (const auto &dev : m_adapter->devices()) {
-                if (dev->isPaired()) {
-                    const auto key = dev->address();
-                    if (!m_btSwitches.contains(key)) {
-                        auto sw = new BluetoothDeviceSwitch(dev, this);
-                        m_btSwitches.insert(key, sw);
-                    }
-                }
-            }
+    // Each device is looked at once when it appears, after that only its own signals matter
+    connect(m_adapter.data(), &BluezQt::Adapter::deviceAdded, this, &BluetoothAdapterWatcher::onDeviceAdded);
+    connect(m_adapter.data(), &BluezQt::Adapter::deviceRemoved, this, &BluetoothAdapterWatcher::onDeviceRemoved);
+    for (const auto &dev : m_adapter->devices())
+        onDeviceAdded(dev);
 
-        } 
-        else {
-            qCWarning(bt) << "No adapters found";
-            m_switch->setState(false);
-        }
+    // Connect to signal from switch to adapter, so we can turn bluetooth on/off
+    connect(m_switch, &Switch::stateChangeRequested, this, [this](bool requestedState){
+        m_adapter->setPowered(requestedState);
+        qCDebug(bt) << "Set adapter" << m_adapter->name() << "powered to" << requestedState;
     });
 
-    job->start();
+    m_switch->runtimeRegistration();
+}
 
-    // Connect to signal from switch to adapter, so we can turn bluetooth on/off
-    connect(m_switch, &Switch::stateChangeRequested, this, [this](bool requestedState){
-        if (!m_initialized || !m_adapter)
-            return;
+void BluetoothAdapterWatcher::unRegister()
+{
+    m_switch->unRegister();
+    unRegisterDevices();
+}
 
-        m_adapter->setPowered(requestedState);
-        qCDebug(bt) << "Set adapter powered to" << requestedState;
+void BluetoothAdapterWatcher::unRegisterDevices()
+{
+    for (auto *sw : std::as_const(m_btSwitches))
+        sw->unRegister();
+}
+
+void BluetoothAdapterWatcher::onDeviceAdded(const BluezQt::DevicePtr &device)
+{
+    // The weak pointer keeps the lambdas from holding discovered devices alive
+    const QWeakPointer<BluezQt::Device> weak = device.toWeakRef();
+    connect(device.data(), &BluezQt::Device::pairedChanged, this, [this, weak]() {
+        if (auto dev = weak.toStrongRef())
+            onPairedChanged(dev);
     });
+    if (m_nearby) {
+        connect(device.data(), &BluezQt::Device::rssiChanged, this, [this, weak]() {
+            auto dev = weak.toStrongRef();
+            if (dev && !dev->isPaired())
+                m_nearby->deviceSeen(dev);
+        });
+    }
+    onPairedChanged(device);
 }
-void BluetoothAdapterWatcher::CheckPairedState()
+
+void BluetoothAdapterWatcher::onDeviceRemoved(const BluezQt::DevicePtr &device)
 {
-    if(!m_adapter) return;
-
-    for (const auto &dev : m_adapter->devices()) {
-        const auto key = dev->address();
-            if (dev->isPaired()) {
-                if (!m_btSwitches.contains(key)) {
-                    auto sw = new BluetoothDeviceSwitch(dev, this);
-                    m_btSwitches.insert(key, sw);
-                    }
-            }
-            else {
-            // device is no longer paired, remove the switch if it exists
-            //Does anyone know how to actually unpair? I can't find anything making paired state change, forget from settings does not work
-                if (m_btSwitches.contains(key)) {
-                    auto *sw = m_btSwitches.take(key);
-                    sw->deleteLater();
-                }
-            }
+    if (m_nearby)
+        m_nearby->deviceGone(device->address());
+    if (m_btSwitches.contains(device->address()))
+        qCInfo(bt) << "Bluetooth device removed: " << device->name() << " (" << device->address() << ")";
+    removeDeviceSwitch(device->address());
+}
+
+void BluetoothAdapterWatcher::onPairedChanged(const BluezQt::DevicePtr &device)
+{
+    const QString key = device->address();
+    if (device->isPaired()) {
+        if (!m_btSwitches.contains(key))
+            m_btSwitches.insert(key, new BluetoothDeviceSwitch(device, m_deviceIdPrefix, this));
+        if (m_nearby)
+            m_nearby->deviceGone(key);
+    } else if (m_btSwitches.contains(key)) {
+        // device is no longer paired, drop its switch from HA as well
+        qCDebug(bt) << device->name() << " is not paired anymore";
+        removeDeviceSwitch(key);
+    } else if (m_nearby) {
+        m_nearby->deviceSeen(device);
     }
 }
-void BluetoothAdapterWatcher::update(){
-    if(!m_adapter || !m_switch)
-    {
-        qCWarning(bt) << "No adapter or switch found";
-        return;
+
+void BluetoothAdapterWatcher::removeDeviceSwitch(const QString &key)
+{
+    if (auto *sw = m_btSwitches.take(key)) {
+        sw->unRegister();
+        sw->deleteLater();
     }
+}
 
+void BluetoothAdapterWatcher::update(){
     //Adapter state
-    //Only change icon and state if its actually not matching HA
+    //Only change state if its actually not matching HA, the icon is the state_icon attribute so discovery is untouched
     bool powered =  m_adapter->isPowered();  
-    if (powered && !m_switch->state()){
-        m_switch->setHaIcon("mdi:bluetooth");
-    } else if (!powered && m_switch->state()) {    
-        m_switch->setHaIcon("mdi:bluetooth-off");
-    }
     if(m_switch->state() != powered)
         m_switch->setState(powered);
     QVariantMap attrs;
+    attrs["state_icon"] = powered ? "mdi:bluetooth" : "mdi:bluetooth-off";
     attrs["mac"] = m_adapter->address();
     attrs["name"] = m_adapter->name();
     attrs["system_name"] = m_adapter->systemName();
@@ -246,10 +383,127 @@ void BluetoothAdapterWatcher::update(){
         m_switch->setAttributes(attrs);
 
 }
+
+// ====== Bluetooth Manager code ======
+class Bluetooth : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Bluetooth(QObject *parent = nullptr);
+
+private:
+    void onAdapterAdded(const BluezQt::AdapterPtr &adapter);
+    void onAdapterRemoved(const BluezQt::AdapterPtr &adapter);
+    void updatePlaceholder();
+    BluezQt::Manager *m_manager = nullptr;
+    QHash<QString, BluetoothAdapterWatcher *> m_adapters; // ubi -> watcher
+    QString m_legacyAdapter; // address of the adapter with the unsuffixed ids
+    QString m_legacyUbi; // set while that adapter is present
+    // Stands in for the legacy adapter switch while that adapter is missing, always off
+    Switch *m_placeholder = nullptr;
+    BluetoothNearbyDevices *m_nearby = nullptr;
+};
+
+Bluetooth::Bluetooth(QObject *parent)
+    : QObject(parent)
+{
+    // Scanning results are opt in, they are noisy and most people don't want them
+    const KConfigGroup config = KSharedConfig::openConfig()->group("Bluetooth");
+    if (config.readEntry("NearbyDevices", false))
+        m_nearby = new BluetoothNearbyDevices(this);
+
+    m_legacyAdapter = KSharedConfig::openStateConfig()->group("Bluetooth").readEntry("LegacyAdapter");
+    updatePlaceholder();
+
+    m_manager = new BluezQt::Manager(this);
+
+    // create the init job
+    BluezQt::InitManagerJob *job = m_manager->init();
+
+    connect(job, &BluezQt::InitManagerJob::result, this, [this, job]() {
+        if (job->error()) {
+            qCWarning(bt) << "Bluez init failed:" << job->errorText();
+            return;
+        }
+
+        // USB dongles come and go, so adapters are followed for the whole session
+        connect(m_manager, &BluezQt::Manager::adapterAdded, this, &Bluetooth::onAdapterAdded);
+        connect(m_manager, &BluezQt::Manager::adapterRemoved, this, &Bluetooth::onAdapterRemoved);
+        auto adapters = m_manager->adapters();
+        if (adapters.isEmpty())
+            qCWarning(bt) << "No adapters found";
+        // On the first run hci0 is the adapter that was used before, so it gets the legacy ids
+        std::sort(adapters.begin(), adapters.end(), [](const BluezQt::AdapterPtr &a, const BluezQt::AdapterPtr &b) {
+            return a->ubi() < b->ubi();
+        });
+        for (const auto &adapter : adapters)
+            onAdapterAdded(adapter);
+    });
+
+    job->start();
+}
+
+void Bluetooth::onAdapterAdded(const BluezQt::AdapterPtr &adapter)
+{
+    if (m_adapters.contains(adapter->ubi()))
+        return;
+    qCInfo(bt) << "Bluetooth adapter added: " << adapter->name() << " (" << adapter->ubi() << ")";
+    if (m_legacyAdapter.isEmpty()) {
+        m_legacyAdapter = adapter->address();
+        KConfigGroup state = KSharedConfig::openStateConfig()->group("Bluetooth");
+        state.writeEntry("LegacyAdapter", m_legacyAdapter);
+        state.sync();
+    }
+    const bool legacyIds = adapter->address() == m_legacyAdapter;
+    if (legacyIds) {
+        m_legacyUbi = adapter->ubi();
+        // Same entity id, the watcher's switch takes over the discovery config
+        delete m_placeholder;
+        m_placeholder = nullptr;
+    }
+    m_adapters.insert(adapter->ubi(), new BluetoothAdapterWatcher(adapter, legacyIds, m_nearby, this));
+}
+
+void Bluetooth::onAdapterRemoved(const BluezQt::AdapterPtr &adapter)
+{
+    if (auto *watcher = m_adapters.take(adapter->ubi())) {
+        qCInfo(bt) << "Bluetooth adapter removed: " << adapter->name() << " (" << adapter->ubi() << ")";
+        if (adapter->ubi() == m_legacyUbi) {
+            // The placeholder reuses the adapter switch, only the device switches go away.
+            // Deleted right away, the old switch must not outlive the placeholder's creation
+            // or both would answer on the same command topic
+            m_legacyUbi.clear();
+            watcher->unRegisterDevices();
+            delete watcher;
+            updatePlaceholder();
+        } else {
+            watcher->unRegister();
+            watcher->deleteLater();
+        }
+    }
+}
+
+void Bluetooth::updatePlaceholder()
+{
+    if (!m_legacyUbi.isEmpty() || m_placeholder)
+        return;
+    m_placeholder = new Switch(this);
+    m_placeholder->setId(QStringLiteral("bluetooth_adapter"));
+    m_placeholder->setName(QStringLiteral("Bluetooth Adapter"));
+    m_placeholder->setDiscoveryConfig("icon", "mdi:bluetooth-off");
+    m_placeholder->setState(false);
+    connect(m_placeholder, &Switch::stateChangeRequested, this, [this]() {
+        qCWarning(bt) << "No Bluetooth adapter to power on";
+        m_placeholder->setState(false);
+    });
+    m_placeholder->runtimeRegistration();
+}
+
 // setup function
 void setupBluetoothAdapter()
 {
-    new BluetoothAdapterWatcher(qApp);
+    new Bluetooth(qApp);
 }
 
 REGISTER_INTEGRATION("Bluetooth", setupBluetoothAdapter, true)
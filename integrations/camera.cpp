@@ -1,20 +1,18 @@
 // SPDX-FileCopyrightText: 2025 David Edmundson <davidedmundson@kde.org>
 // SPDX-License-Identifier: LGPL-2.1-or-later
 
-// SPDX-FileCopyrightText: 1998 Sven Radej <sven@lisa.exp.univie.ac.at>
-//      SPDX-FileCopyrightText: 2006 Dirk Mueller <mueller@kde.org>
-//          SPDX-FileCopyrightText: 2007 Flavio Castelli <flavio.castelli@gmail.com>
-
 #include "core.h"
 #include "entities/entities.h"
-#include <KIdleTime>
+#include "inotifyhub.h"
 
 #include <QDir>
-#include <QSocketNotifier>
+#include <QFile>
+#include <QSet>
 #include <QTimer>
-#include <fcntl.h>
-#include <sys/inotify.h>
-#include <sys/ioctl.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
 #include <unistd.h>
 
 #include <QLoggingCategory>
@@ -26,27 +24,31 @@ class CameraWatcher : public QObject
     Q_OBJECT
 public:
     CameraWatcher(QObject *parent);
-    ~CameraWatcher();
 
 private:
     BinarySensor *m_sensor;
-    void onInotifyCallback();
-    void onInotifyEvent(const inotify_event *event);
-    void onVideoDeviceAdded(const QString &devicePath);
+    void onDevEvent(const inotify_event *event);
+    void onVideoDeviceEvent(const QString &devicePath, const inotify_event *event);
+    void onVideoDeviceAdded(const QString &devicePath, int attempt = 0);
     void onVideoDeviceRemoved(const QString &devicePath);
+    void resync();
 
-    int m_inotifyFd = -1;
-    QSocketNotifier *m_notifier = nullptr;
-    QHash<QString, int> m_watchFds;
+    // device path -> InotifyHub subscription, the hub dispatches by watch descriptor
+    QHash<QString, int> m_watches;
     QHash<QString, int> m_deviceOpenCounts;
+    int m_totalOpen = 0;
     QTimer *m_hysterisisDelay = nullptr;
+    QTimer *m_resyncTimer = nullptr;
 
     void updateSensorState();
+    // openCounts, when given, receives the number of open file descriptors per device
+    QVariantList findCameraUsers(QHash<QString, int> *openCounts = nullptr) const;
 };
 
 CameraWatcher::CameraWatcher(QObject *parent)
     : QObject(parent)
     , m_hysterisisDelay(new QTimer(this))
+    , m_resyncTimer(new QTimer(this))
 {
     m_sensor = new BinarySensor(this);
     m_sensor->setId("camera");
@@ -56,12 +58,21 @@ CameraWatcher::CameraWatcher(QObject *parent)
     m_hysterisisDelay->setInterval(1000);
     m_hysterisisDelay->setSingleShot(true);
     connect(m_hysterisisDelay, &QTimer::timeout, this, [this]() {
+        // Only scan /proc on the open edge, it's far too expensive to do per event
+        QVariantMap attributes;
+        attributes["applications"] = findCameraUsers();
+        m_sensor->setAttributes(attributes);
         m_sensor->setState(true);
     });
 
-    m_inotifyFd = inotify_init();
-    (void)fcntl(m_inotifyFd, F_SETFD, FD_CLOEXEC);
-    inotify_add_watch(m_inotifyFd, "/dev", IN_CREATE | IN_DELETE);
+    // Every subscription gets the overflow, resync once for all of them
+    m_resyncTimer->setSingleShot(true);
+    m_resyncTimer->setInterval(0);
+    connect(m_resyncTimer, &QTimer::timeout, this, &CameraWatcher::resync);
+
+    InotifyHub::self()->subscribe("/dev", IN_CREATE | IN_DELETE, this, [this](const inotify_event *event) {
+        onDevEvent(event);
+    });
 
     QDir devDir("/dev");
     devDir.setFilter(QDir::System);
@@ -69,134 +80,188 @@ CameraWatcher::CameraWatcher(QObject *parent)
     for (const QString &entry : devDir.entryList()) {
         onVideoDeviceAdded("/dev/" + entry);
     }
-
-    m_notifier = new QSocketNotifier(m_inotifyFd, QSocketNotifier::Read, this);
-    connect(m_notifier, &QSocketNotifier::activated, this, &CameraWatcher::onInotifyCallback);
-    m_notifier->setEnabled(true);
 }
 
-CameraWatcher::~CameraWatcher()
+void CameraWatcher::resync()
 {
-    for (int fd : m_watchFds.values()) {
-        if (fd != -1) {
-            inotify_rm_watch(m_inotifyFd, fd);
+    qCDebug(cam) << "Resyncing after inotify queue overflow";
+    QDir devDir("/dev");
+    devDir.setFilter(QDir::System);
+    devDir.setNameFilters({"video*"});
+    QSet<QString> present;
+    for (const QString &entry : devDir.entryList()) {
+        present.insert("/dev/" + entry);
+    }
+    const QStringList watched = m_watches.keys();
+    for (const QString &devicePath : watched) {
+        if (!present.contains(devicePath)) {
+            onVideoDeviceRemoved(devicePath);
         }
     }
-    if (m_inotifyFd != -1) {
-        close(m_inotifyFd);
+    for (const QString &devicePath : std::as_const(present)) {
+        onVideoDeviceAdded(devicePath);
     }
-}
-
-void CameraWatcher::onInotifyCallback()
-{
-    int pending = -1;
-    int offsetStartRead = 0; // where we read into buffer
-    char buf[8192];
-    ioctl(m_inotifyFd, FIONREAD, &pending);
-
-    // copied from KDirWatchPrivate::processInotifyEvents
-    while (pending > 0) {
-        const int bytesToRead = qMin<int>(pending, sizeof(buf) - offsetStartRead);
-
-        int bytesAvailable = read(m_inotifyFd, &buf[offsetStartRead], bytesToRead);
-        pending -= bytesAvailable;
-        bytesAvailable += offsetStartRead;
-        offsetStartRead = 0;
-
-        int offsetCurrent = 0;
-        while (bytesAvailable >= int(sizeof(struct inotify_event))) {
-            const struct inotify_event *const event = reinterpret_cast<inotify_event *>(&buf[offsetCurrent]);
-
-            const int eventSize = sizeof(struct inotify_event) + event->len;
-            if (bytesAvailable < eventSize) {
-                break;
-            }
-
-            bytesAvailable -= eventSize;
-            offsetCurrent += eventSize;
 
-            onInotifyEvent(event);
-        }
-        if (bytesAvailable > 0) {
-            // copy partial event to beginning of buffer
-            memmove(buf, &buf[offsetCurrent], bytesAvailable);
-            offsetStartRead = bytesAvailable;
-        }
+    // Open and close events were lost, count what is open right now instead
+    QHash<QString, int> openCounts;
+    findCameraUsers(&openCounts);
+    m_deviceOpenCounts = openCounts;
+    m_totalOpen = 0;
+    for (int count : std::as_const(openCounts)) {
+        m_totalOpen += count;
     }
+    updateSensorState();
 }
 
-void CameraWatcher::onInotifyEvent(const struct inotify_event *event)
+void CameraWatcher::onDevEvent(const inotify_event *event)
 {
+    if (event->mask & IN_Q_OVERFLOW) {
+        m_resyncTimer->start();
+        return;
+    }
+    if (!event->len) {
+        return;
+    }
     QString deviceName = QString::fromLatin1(event->name);
+    if (!deviceName.startsWith("video")) {
+        return;
+    }
     if (event->mask & IN_CREATE) {
-        if (deviceName.startsWith("video")) {
-            QTimer::singleShot(5000, this, [this, deviceName]() {
-                onVideoDeviceAdded("/dev/" + deviceName);
-            });
-        }
+        onVideoDeviceAdded("/dev/" + deviceName);
     }
-
     if (event->mask & IN_DELETE) {
-        if (deviceName.startsWith("video")) {
-            onVideoDeviceRemoved("/dev/" + deviceName);
-        }
+        onVideoDeviceRemoved("/dev/" + deviceName);
     }
+}
 
-    if (event->mask & (IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE | IN_DELETE_SELF)) {
-        QString devPath;
-        for (auto it = m_watchFds.constBegin(); it != m_watchFds.constEnd(); ++it) {
-            if (it.value() == event->wd) {
-                devPath = it.key();
-                break;
-            }
-        }
-        if (devPath.isEmpty())
-            return;
-
-        if (event->mask & IN_OPEN) {
-            m_deviceOpenCounts[devPath]++;
-        } else if (event->mask & (IN_CLOSE_WRITE | IN_CLOSE_NOWRITE)) {
-            if (m_deviceOpenCounts.contains(devPath) && m_deviceOpenCounts[devPath] > 0)
-                m_deviceOpenCounts[devPath]--;
-        } else if (event->mask & IN_DELETE_SELF) {
-            m_deviceOpenCounts.remove(devPath);
+void CameraWatcher::onVideoDeviceEvent(const QString &devicePath, const inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW) {
+        m_resyncTimer->start();
+        return;
+    }
+    if (event->mask & IN_OPEN) {
+        m_deviceOpenCounts[devicePath]++;
+        m_totalOpen++;
+    } else if (event->mask & (IN_CLOSE_WRITE | IN_CLOSE_NOWRITE)) {
+        auto it = m_deviceOpenCounts.find(devicePath);
+        if (it != m_deviceOpenCounts.end() && it.value() > 0) {
+            it.value()--;
+            m_totalOpen--;
         }
-
-        updateSensorState();
+    } else if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+        // IN_IGNORED means the hub already dropped our subscription
+        m_watches.remove(devicePath);
+        m_totalOpen -= m_deviceOpenCounts.take(devicePath);
     }
+
+    updateSensorState();
 }
 
 void CameraWatcher::updateSensorState()
 {
-    int totalOpen = 0;
-    for (int val : m_deviceOpenCounts.values())
-        totalOpen += val;
-
-    if (totalOpen == 0) {
+    if (m_totalOpen == 0) {
         m_hysterisisDelay->stop();
         m_sensor->setState(false);
-    } else if (totalOpen == 1) {
+        if (!m_sensor->attributes().isEmpty())
+            m_sensor->setAttributes({});
+    } else if (!m_sensor->state() && !m_hysterisisDelay->isActive()) {
         m_hysterisisDelay->start();
     }
 }
 
-void CameraWatcher::onVideoDeviceAdded(const QString &devicePath)
+QVariantList CameraWatcher::findCameraUsers(QHash<QString, int> *openCounts) const
+{
+    QVariantList users;
+    DIR *proc = opendir("/proc");
+    if (!proc) {
+        return users;
+    }
+
+    char linkTarget[PATH_MAX];
+    while (const dirent *pidEntry = readdir(proc)) {
+        if (pidEntry->d_name[0] < '0' || pidEntry->d_name[0] > '9') {
+            continue;
+        }
+        const QByteArray fdDirPath = QByteArrayLiteral("/proc/") + pidEntry->d_name + QByteArrayLiteral("/fd");
+        // Processes of other users are not readable, which is fine, we couldn't name them anyway
+        DIR *fdDir = opendir(fdDirPath.constData());
+        if (!fdDir) {
+            continue;
+        }
+        QStringList devices;
+        while (const dirent *fdEntry = readdir(fdDir)) {
+            if (fdEntry->d_name[0] == '.') {
+                continue;
+            }
+            const QByteArray fdPath = fdDirPath + '/' + fdEntry->d_name;
+            const ssize_t length = readlink(fdPath.constData(), linkTarget, sizeof(linkTarget) - 1);
+            if (length <= 0 || strncmp(linkTarget, "/dev/video", 10) != 0) {
+                continue;
+            }
+            const QString device = QString::fromLatin1(linkTarget, length);
+            if (!m_watches.contains(device)) {
+                continue;
+            }
+            if (openCounts) {
+                (*openCounts)[device]++;
+            }
+            if (!devices.contains(device)) {
+                devices.append(device);
+            }
+        }
+        closedir(fdDir);
+
+        if (!devices.isEmpty()) {
+            QFile comm(QString::fromLatin1("/proc/%1/comm").arg(QString::fromLatin1(pidEntry->d_name)));
+            QString name;
+            if (comm.open(QIODevice::ReadOnly)) {
+                name = QString::fromUtf8(comm.readAll()).trimmed();
+            }
+            QVariantMap user;
+            user["name"] = name;
+            user["pid"] = QString::fromLatin1(pidEntry->d_name);
+            user["devices"] = devices;
+            users.append(user);
+        }
+    }
+    closedir(proc);
+    return users;
+}
+
+void CameraWatcher::onVideoDeviceAdded(const QString &devicePath, int attempt)
 {
-    int wd = inotify_add_watch(m_inotifyFd, devicePath.toUtf8().constData(), IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE | IN_DELETE_SELF);
-    if (wd == -1) {
+    if (m_watches.contains(devicePath)) {
+        return;
+    }
+    const int subscription = InotifyHub::self()->subscribe(devicePath,
+                                                           IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE | IN_DELETE_SELF,
+                                                           this,
+                                                           [this, devicePath](const inotify_event *event) {
+                                                               onVideoDeviceEvent(devicePath, event);
+                                                           });
+    if (subscription == -1) {
+        // New nodes are created root only, udev grants us access a moment later
+        constexpr int maxAttempts = 8;
+        if (errno == EACCES && attempt < maxAttempts && QFile::exists(devicePath)) {
+            QTimer::singleShot(100 << attempt, this, [this, devicePath, attempt]() {
+                onVideoDeviceAdded(devicePath, attempt + 1);
+            });
+            return;
+        }
         qCWarning(cam) << "Failed to watch" << devicePath;
         return;
     }
-    m_watchFds[devicePath] = wd;
+    m_watches[devicePath] = subscription;
 }
 
 void CameraWatcher::onVideoDeviceRemoved(const QString &devicePath)
 {
-    int fd = m_watchFds.take(devicePath);
-    if (fd >= 1) {
-        inotify_rm_watch(m_inotifyFd, fd);
+    const int subscription = m_watches.take(devicePath);
+    if (subscription > 0) {
+        InotifyHub::self()->unsubscribe(subscription);
     }
-    m_deviceOpenCounts.remove(devicePath);
+    m_totalOpen -= m_deviceOpenCounts.take(devicePath);
     updateSensorState();
 }
 
@@ -0,0 +1,346 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "core.h"
+#include "entities/entities.h"
+#include <KConfigGroup>
+#include <KProcess>
+#include <KSandbox>
+#include <KSharedConfig>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QQueue>
+#include <QTimer>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(cmdsensors)
+Q_LOGGING_CATEGORY(cmdsensors, "integration.CommandSensors")
+
+// Commands running at the same time over all command sensors
+static constexpr int s_maxConcurrent = 4;
+// Deadlines are rounded up to this, so sensors due around the same time share a wakeup
+static constexpr qint64 s_slotMs = 1000;
+// Stdout beyond this is drained and dropped
+static constexpr qsizetype s_maxOutput = 64 * 1024;
+// HA rejects longer states
+static constexpr int s_maxStateLength = 255;
+
+struct CommandSensor {
+    enum class Parse {
+        Raw,
+        Number,
+        Json,
+    };
+
+    QString id;
+    QString program;
+    QStringList arguments;
+    qint64 intervalMs = 60 * 1000;
+    qint64 timeoutMs = 60 * 1000;
+    Parse parse = Parse::Raw;
+    QStringList jsonPath;
+    Sensor *sensor = nullptr;
+
+    QProcess *process = nullptr;
+    bool waiting = false; // due, but held back by the concurrency cap
+    QByteArray output;
+    int skipped = 0;
+};
+
+// Follows a dot separated path like "data.items.0.value", numbers index arrays
+static QJsonValue resolveJsonPath(const QJsonValue &root, const QStringList &path)
+{
+    QJsonValue value = root;
+    for (const QString &key : path) {
+        if (value.isArray()) {
+            bool ok = false;
+            const int index = key.toInt(&ok);
+            value = ok ? value.toArray().at(index) : QJsonValue(QJsonValue::Undefined);
+        } else {
+            value = value.toObject().value(key);
+        }
+        if (value.isUndefined()) {
+            break;
+        }
+    }
+    return value;
+}
+
+// All command sensors share one timer. Due times live in a map of slot -> sensors, so
+// a wakeup only looks at the sensors that are actually due.
+class CommandSensors : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CommandSensors(QObject *parent = nullptr);
+    int count() const
+    {
+        return m_sensors.size();
+    }
+
+private:
+    void load();
+    void schedule(int index);
+    void armTimer();
+    void onTimeout();
+    void tryStart(int index);
+    void startNext();
+    void onFinished(int index, int exitCode, QProcess::ExitStatus exitStatus);
+    bool parseOutput(CommandSensor &entry, QString &state) const;
+
+    QList<CommandSensor> m_sensors;
+    QMap<qint64, QList<int>> m_wheel; // slot deadline -> sensor indexes
+    QQueue<int> m_ready;
+    int m_running = 0;
+    QElapsedTimer m_clock;
+    QTimer *m_timer;
+};
+
+CommandSensors::CommandSensors(QObject *parent)
+    : QObject(parent)
+    , m_timer(new QTimer(this))
+{
+    m_clock.start();
+    m_timer->setSingleShot(true);
+    m_timer->setTimerType(Qt::CoarseTimer);
+    connect(m_timer, &QTimer::timeout, this, &CommandSensors::onTimeout);
+
+    load();
+    // First sample right away, then aligned to the interval
+    for (int i = 0; i < m_sensors.size(); ++i) {
+        tryStart(i);
+        schedule(i);
+    }
+    armTimer();
+}
+
+void CommandSensors::load()
+{
+    auto toplevel = KSharedConfig::openConfig()->group("CommandSensors");
+    const QStringList ids = toplevel.groupList();
+    for (const QString &id : ids) {
+        const KConfigGroup config = toplevel.group(id);
+        QStringList args = QProcess::splitCommand(config.readEntry("Exec"));
+        if (args.isEmpty()) {
+            qCWarning(cmdsensors) << "Could not parse Exec entry for command sensor" << id;
+            continue;
+        }
+
+        CommandSensor entry;
+        entry.id = id;
+        entry.program = args.takeFirst();
+        entry.arguments = args;
+        if (KSandbox::isFlatpak()) {
+            KProcess process;
+            process.setProgram(entry.program);
+            process.setArguments(entry.arguments);
+            const KSandbox::ProcessContext ctx = KSandbox::makeHostContext(process);
+            entry.program = ctx.program;
+            entry.arguments = ctx.arguments;
+        }
+
+        entry.intervalMs = qMax(1, config.readEntry("Interval", 60)) * 1000;
+        entry.timeoutMs = qMax(1, config.readEntry("Timeout", int(entry.intervalMs / 1000))) * 1000;
+
+        const QString parse = config.readEntry("Parse", "raw").toLower();
+        if (parse == QLatin1String("number")) {
+            entry.parse = CommandSensor::Parse::Number;
+        } else if (parse == QLatin1String("json")) {
+            entry.parse = CommandSensor::Parse::Json;
+            entry.jsonPath = config.readEntry("JsonPath").split(QLatin1Char('.'), Qt::SkipEmptyParts);
+        } else if (parse != QLatin1String("raw")) {
+            qCWarning(cmdsensors) << "Unknown Parse" << parse << "for command sensor" << id << ", using raw";
+        }
+
+        entry.sensor = new Sensor(this);
+        entry.sensor->setId(id);
+        entry.sensor->setName(config.readEntry("Name", id));
+        entry.sensor->setDiscoveryConfig("icon", config.readEntry("icon", "mdi:console"));
+        const QString unit = config.readEntry("Unit");
+        if (!unit.isEmpty()) {
+            entry.sensor->setDiscoveryConfig("unit_of_measurement", unit);
+        }
+        if (entry.parse == CommandSensor::Parse::Number) {
+            entry.sensor->setDiscoveryConfig("state_class", "measurement");
+        }
+        m_sensors.append(entry);
+    }
+    if (!m_sensors.isEmpty())
+        qCInfo(cmdsensors) << "Loaded" << m_sensors.size() << "command sensors";
+}
+
+void CommandSensors::schedule(int index)
+{
+    // Aligning to multiples of the interval makes sensors with related intervals fire together
+    const qint64 interval = m_sensors[index].intervalMs;
+    qint64 deadline = (m_clock.elapsed() / interval + 1) * interval;
+    deadline = (deadline + s_slotMs - 1) / s_slotMs * s_slotMs;
+    m_wheel[deadline].append(index);
+}
+
+void CommandSensors::armTimer()
+{
+    if (m_wheel.isEmpty()) {
+        m_timer->stop();
+        return;
+    }
+    m_timer->start(qMax<qint64>(0, m_wheel.firstKey() - m_clock.elapsed()));
+}
+
+void CommandSensors::onTimeout()
+{
+    const qint64 now = m_clock.elapsed();
+    while (!m_wheel.isEmpty() && m_wheel.firstKey() <= now) {
+        const QList<int> due = m_wheel.take(m_wheel.firstKey());
+        for (int index : due) {
+            tryStart(index);
+            schedule(index);
+        }
+    }
+    armTimer();
+}
+
+void CommandSensors::tryStart(int index)
+{
+    CommandSensor &entry = m_sensors[index];
+    // Still busy with the previous sample, skip this one rather than pile up
+    if (entry.process || entry.waiting) {
+        ++entry.skipped;
+        qCDebug(cmdsensors) << "Command sensor" << entry.id << "overran its interval, skipping";
+        return;
+    }
+    entry.waiting = true;
+    m_ready.enqueue(index);
+    startNext();
+}
+
+void CommandSensors::startNext()
+{
+    while (m_running < s_maxConcurrent && !m_ready.isEmpty()) {
+        const int index = m_ready.dequeue();
+        CommandSensor &entry = m_sensors[index];
+        entry.waiting = false;
+        entry.output.clear();
+
+        auto *process = new QProcess(this);
+        entry.process = process;
+        process->setProgram(entry.program);
+        process->setArguments(entry.arguments);
+        process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        connect(process, &QProcess::readyReadStandardOutput, this, [this, index, process]() {
+            QByteArray &output = m_sensors[index].output;
+            const QByteArray data = process->readAllStandardOutput();
+            if (output.size() < s_maxOutput) {
+                output.append(data.left(s_maxOutput - output.size()));
+            }
+        });
+        connect(process, &QProcess::finished, this, [this, index](int exitCode, QProcess::ExitStatus exitStatus) {
+            onFinished(index, exitCode, exitStatus);
+        });
+        connect(process, &QProcess::errorOccurred, this, [this, index, process](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart) {
+                qCWarning(cmdsensors) << "Command sensor" << m_sensors[index].id << "failed to start:" << process->errorString();
+                onFinished(index, -1, QProcess::CrashExit);
+            }
+        });
+        QTimer::singleShot(entry.timeoutMs, process, [this, index, process]() {
+            qCWarning(cmdsensors) << "Command sensor" << m_sensors[index].id << "timed out";
+            process->kill();
+        });
+
+        ++m_running;
+        process->start();
+    }
+}
+
+void CommandSensors::onFinished(int index, int exitCode, QProcess::ExitStatus exitStatus)
+{
+    CommandSensor &entry = m_sensors[index];
+    if (!entry.process) {
+        return;
+    }
+    entry.process->deleteLater();
+    entry.process = nullptr;
+    --m_running;
+
+    if (exitStatus == QProcess::NormalExit && exitCode == 0) {
+        QString state;
+        if (parseOutput(entry, state)) {
+            if (entry.sensor->state() != state) {
+                entry.sensor->setState(state);
+            }
+        } else {
+            qCWarning(cmdsensors) << "Could not parse output of command sensor" << entry.id;
+        }
+    } else {
+        qCDebug(cmdsensors) << "Command sensor" << entry.id << "exited with" << exitCode;
+    }
+
+    QVariantMap attributes;
+    attributes["exit_code"] = exitStatus == QProcess::NormalExit ? exitCode : -1;
+    attributes["skipped"] = entry.skipped;
+    if (entry.sensor->attributes() != attributes) {
+        entry.sensor->setAttributes(attributes);
+    }
+    startNext();
+}
+
+bool CommandSensors::parseOutput(CommandSensor &entry, QString &state) const
+{
+    switch (entry.parse) {
+    case CommandSensor::Parse::Raw:
+        state = QString::fromUtf8(entry.output).trimmed().left(s_maxStateLength);
+        return true;
+    case CommandSensor::Parse::Number: {
+        bool ok = false;
+        const double number = QString::fromUtf8(entry.output).section(QLatin1Char('\n'), 0, 0).trimmed().toDouble(&ok);
+        if (ok) {
+            state = QString::number(number);
+        }
+        return ok;
+    }
+    case CommandSensor::Parse::Json: {
+        QJsonParseError error;
+        const QJsonDocument doc = QJsonDocument::fromJson(entry.output, &error);
+        if (error.error != QJsonParseError::NoError) {
+            return false;
+        }
+        const QJsonValue root = doc.isArray() ? QJsonValue(doc.array()) : QJsonValue(doc.object());
+        const QJsonValue value = resolveJsonPath(root, entry.jsonPath);
+        if (value.isUndefined() || value.isNull()) {
+            return false;
+        }
+        if (value.isDouble()) {
+            state = QString::number(value.toDouble());
+        } else if (value.isBool()) {
+            state = value.toBool() ? QStringLiteral("true") : QStringLiteral("false");
+        } else if (value.isString()) {
+            state = value.toString();
+        } else {
+            const QJsonDocument nested = value.isArray() ? QJsonDocument(value.toArray()) : QJsonDocument(value.toObject());
+            state = QString::fromUtf8(nested.toJson(QJsonDocument::Compact));
+        }
+        state.truncate(s_maxStateLength);
+        return true;
+    }
+    }
+    return false;
+}
+
+void setupCommandSensors()
+{
+    auto sensors = new CommandSensors(qApp);
+    if (sensors->count() == 0) {
+        delete sensors;
+    }
+}
+
+REGISTER_INTEGRATION("CommandSensors", setupCommandSensors, true)
+
+#include "commandsensors.moc"
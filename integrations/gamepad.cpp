@@ -3,32 +3,172 @@
 
 #include "core.h"
 #include "entities/entities.h"
+#include "udevhub.h"
 #include <QCoreApplication>
-#include <QSocketNotifier>
-#include <QTimer>
-#include <libudev.h>
-#include <unistd.h>
+#include <QRegularExpression>
+#include <QSet>
 
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(gamepad)
 Q_LOGGING_CATEGORY(gamepad, "integration.Gamepad")
 
+// We track the js and event nodes, systemd's persistent input rules only give those the ID_* properties.
+// What the kernel knows about the controller itself lives on the parent inputN device.
+static QString inputAttr(const UdevDevice &node, const QString &name)
+{
+    UdevDevice input;
+    input.syspath = node.ancestors.value(QStringLiteral("input"));
+    return input.syspath.isEmpty() ? QString() : input.sysattr(name);
+}
+
+// Bus types from linux/input.h, used when udev has no ID_BUS (e.g. bluetooth through uhid)
+static QString connectionType(const UdevDevice &node)
+{
+    const QString bus = node.property(QStringLiteral("ID_BUS"));
+    if (!bus.isEmpty()) {
+        return bus;
+    }
+    bool ok = false;
+    const int busType = inputAttr(node, QStringLiteral("id/bustype")).toInt(&ok, 16);
+    if (!ok) {
+        return QString();
+    }
+    switch (busType) {
+    case 0x03:
+        return QStringLiteral("usb");
+    case 0x05:
+        return QStringLiteral("bluetooth");
+    default:
+        return QStringLiteral("other");
+    }
+}
+
+class GamepadController : public QObject
+{
+    Q_OBJECT
+public:
+    GamepadController(const QString &key, const UdevDevice &device, QObject *parent);
+    void setBattery(const UdevDevice &supply);
+    void clearBattery();
+    void unRegister();
+
+    QString hidSyspath;
+    QSet<QString> inputs;
+
+private:
+    void publishAttributes();
+
+    QString m_id;
+    QString m_name;
+    QVariantMap m_attributes;
+    BinarySensor *m_sensor = nullptr;
+    Sensor *m_battery = nullptr;
+};
+
+GamepadController::GamepadController(const QString &key, const UdevDevice &device, QObject *parent)
+    : QObject(parent)
+    , hidSyspath(device.ancestors.value(QStringLiteral("hid")))
+{
+    static const QRegularExpression invalidChars(QStringLiteral("[^a-z0-9]+"));
+    m_id = "gamepad_" + key.toLower().replace(invalidChars, QStringLiteral("_"));
+
+    m_name = inputAttr(device, QStringLiteral("name"));
+    if (m_name.isEmpty()) {
+        m_name = device.property(QStringLiteral("ID_MODEL")).replace(QLatin1Char('_'), QLatin1Char(' '));
+    }
+    if (m_name.isEmpty()) {
+        m_name = QStringLiteral("Gamepad");
+    }
+
+    QString vendor = device.property(QStringLiteral("ID_VENDOR_FROM_DATABASE"));
+    if (vendor.isEmpty()) {
+        vendor = device.property(QStringLiteral("ID_VENDOR"));
+    }
+    m_attributes["name"] = m_name;
+    m_attributes["vendor"] = vendor;
+    m_attributes["connection"] = connectionType(device);
+
+    m_sensor = new BinarySensor(this);
+    m_sensor->setId(m_id);
+    m_sensor->setName(m_name);
+    m_sensor->setDiscoveryConfig("device_class", "connectivity");
+    m_sensor->setDiscoveryConfig("icon", "mdi:gamepad-variant");
+    m_sensor->setState(true);
+    m_sensor->setAttributes(m_attributes);
+    m_sensor->runtimeRegistration();
+}
+
+void GamepadController::setBattery(const UdevDevice &supply)
+{
+    QString capacity = supply.property(QStringLiteral("POWER_SUPPLY_CAPACITY"));
+    if (capacity.isEmpty()) {
+        capacity = supply.sysattr(QStringLiteral("capacity"));
+    }
+    if (capacity.isEmpty()) {
+        return;
+    }
+
+    if (!m_battery) {
+        m_battery = new Sensor(this);
+        m_battery->setId(m_id + "_battery");
+        m_battery->setName(m_name + " Battery");
+        m_battery->setDiscoveryConfig("device_class", "battery");
+        m_battery->setDiscoveryConfig("unit_of_measurement", "%");
+        m_battery->setDiscoveryConfig("state_class", "measurement");
+        m_battery->runtimeRegistration();
+    }
+    if (m_battery->state() != capacity) {
+        m_battery->setState(capacity);
+    }
+
+    m_attributes["battery"] = capacity.toInt();
+    m_attributes["battery_status"] = supply.property(QStringLiteral("POWER_SUPPLY_STATUS"));
+    publishAttributes();
+}
+
+void GamepadController::clearBattery()
+{
+    if (m_battery) {
+        m_battery->unRegister();
+        m_battery->deleteLater();
+        m_battery = nullptr;
+    }
+    m_attributes.remove("battery");
+    m_attributes.remove("battery_status");
+    publishAttributes();
+}
+
+void GamepadController::unRegister()
+{
+    m_sensor->unRegister();
+    if (m_battery) {
+        m_battery->unRegister();
+    }
+}
+
+void GamepadController::publishAttributes()
+{
+    if (m_sensor->attributes() != m_attributes) {
+        m_sensor->setAttributes(m_attributes);
+    }
+}
+
 class Gamepad : public QObject
 {
     Q_OBJECT
 public:
     explicit Gamepad(QObject *parent = nullptr);
-    ~Gamepad();
-
-private slots:
-    void udevEvent();
 
 private:
-    void updateState();
+    void onInputDevice(UdevHub::Action action, const UdevDevice &device);
+    void onPowerSupply(UdevHub::Action action, const UdevDevice &supply);
+    GamepadController *controllerForHid(const QString &hidSyspath) const;
+    static QString controllerKey(const UdevDevice &device);
+
     BinarySensor *m_sensor;
-    struct udev *m_udev = nullptr;
-    struct udev_monitor *m_monitor = nullptr;
-    QSocketNotifier *m_notifier = nullptr;
+    QHash<QString, GamepadController *> m_controllers; // controller key -> controller
+    QHash<QString, QString> m_inputToController; // input syspath -> controller key
+    QHash<QString, UdevDevice> m_supplies; // hid syspath -> power supply
 };
 
 Gamepad::Gamepad(QObject *parent)
@@ -37,72 +177,117 @@ Gamepad::Gamepad(QObject *parent)
     m_sensor = new BinarySensor(this);
     m_sensor->setId("gamepad_connected");
     m_sensor->setName("Gamepad Connected");
-    // Sett opp udev
-    m_udev = udev_new();
-    if (!m_udev) {
-        qCWarning(gamepad) << "Failed to create udev context";
-        m_sensor->setState(false);
-        return;
-    }
+    m_sensor->setState(false);
 
-    m_monitor = udev_monitor_new_from_netlink(m_udev, "udev");
-    udev_monitor_filter_add_match_subsystem_devtype(m_monitor, "input", nullptr);
-    udev_monitor_enable_receiving(m_monitor);
+    // Controller batteries are power supplies below the controller's hid device.
+    // Subscribed first so a controller finds its battery when it is replayed.
+    UdevFilter supplies;
+    supplies.subsystem = QStringLiteral("power_supply");
+    UdevHub::self()->subscribe(supplies, this, [this](UdevHub::Action action, const UdevDevice &supply) {
+        onPowerSupply(action, supply);
+    });
 
-    int fd = udev_monitor_get_fd(m_monitor);
-    m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
-    connect(m_notifier, &QSocketNotifier::activated, this, &Gamepad::udevEvent);
+    // Present devices are replayed as Added, after that only hotplug events arrive
+    UdevFilter joysticks;
+    joysticks.subsystem = QStringLiteral("input");
+    joysticks.properties.insert(QStringLiteral("ID_INPUT_JOYSTICK"), QStringLiteral("1"));
+    UdevHub::self()->subscribe(joysticks, this, [this](UdevHub::Action action, const UdevDevice &device) {
+        onInputDevice(action, device);
+    });
+}
 
-    // Init state
-    updateState();
+QString Gamepad::controllerKey(const UdevDevice &device)
+{
+    const QString serial = device.property(QStringLiteral("ID_SERIAL"));
+    if (!serial.isEmpty() && serial != QLatin1String("noserial")) {
+        return serial;
+    }
+    // Bluetooth controllers have no ID_SERIAL but report their address in uniq
+    const QString uniq = inputAttr(device, QStringLiteral("uniq"));
+    if (!uniq.isEmpty()) {
+        return uniq;
+    }
+    const QString hid = device.ancestors.value(QStringLiteral("hid"));
+    if (!hid.isEmpty()) {
+        return hid.section(QLatin1Char('/'), -1);
+    }
+    const QString input = device.ancestors.value(QStringLiteral("input"));
+    return input.isEmpty() ? device.syspath : input.section(QLatin1Char('/'), -1);
 }
-Gamepad::~Gamepad()
+
+void Gamepad::onInputDevice(UdevHub::Action action, const UdevDevice &device)
 {
-    if (m_monitor)
-        udev_monitor_unref(m_monitor);
-    if (m_udev)
-        udev_unref(m_udev);
+    // The inputN device itself has no ID_SERIAL, ID_BUS or ID_VENDOR, its js and event nodes do.
+    // A controller usually has both, they end up in the same GamepadController through its key.
+    if (device.devnode.isEmpty()) {
+        return;
+    }
+
+    if (action == UdevHub::Action::Removed) {
+        const QString key = m_inputToController.take(device.syspath);
+        GamepadController *controller = m_controllers.value(key);
+        if (!controller) {
+            return;
+        }
+        controller->inputs.remove(device.syspath);
+        if (controller->inputs.isEmpty()) {
+            qCDebug(gamepad) << "Controller removed" << key;
+            m_controllers.remove(key);
+            controller->unRegister();
+            controller->deleteLater();
+        }
+    } else if (!m_inputToController.contains(device.syspath)) {
+        const QString key = controllerKey(device);
+        GamepadController *controller = m_controllers.value(key);
+        if (!controller) {
+            qCDebug(gamepad) << "Controller added" << key;
+            controller = new GamepadController(key, device, this);
+            m_controllers.insert(key, controller);
+            auto supply = m_supplies.constFind(controller->hidSyspath);
+            if (supply != m_supplies.constEnd()) {
+                controller->setBattery(*supply);
+            }
+        }
+        controller->inputs.insert(device.syspath);
+        m_inputToController.insert(device.syspath, key);
+    }
+
+    m_sensor->setState(!m_controllers.isEmpty());
 }
 
-void Gamepad::udevEvent()
+GamepadController *Gamepad::controllerForHid(const QString &hidSyspath) const
 {
-    struct udev_device *dev = udev_monitor_receive_device(m_monitor);
-    if (dev) {
-        const char *action = udev_device_get_action(dev);
-        if (action && (strcmp(action, "add") == 0 || strcmp(action, "remove") == 0)) {
-            updateState();
+    for (auto *controller : m_controllers) {
+        if (controller->hidSyspath == hidSyspath) {
+            return controller;
         }
-        udev_device_unref(dev);
     }
+    return nullptr;
 }
 
-void Gamepad::updateState()
+void Gamepad::onPowerSupply(UdevHub::Action action, const UdevDevice &supply)
 {
-    // Sjekk om vi har Gamepadd/joystick enheter
-    struct udev_enumerate *enumerate = udev_enumerate_new(m_udev);
-    udev_enumerate_add_match_subsystem(enumerate, "input");
-    udev_enumerate_scan_devices(enumerate);
-
-    struct udev_list_entry *devices = udev_enumerate_get_list_entry(enumerate);
-    bool connected = false;
-    struct udev_list_entry *entry;
-    udev_list_entry_foreach(entry, devices)
-    {
-        const char *path = udev_list_entry_get_name(entry);
-        struct udev_device *dev = udev_device_new_from_syspath(m_udev, path);
-        if (dev) {
-            const char *name = udev_device_get_sysname(dev);
-            if (name && strstr(name, "js") != nullptr) { // enkle js* devices
-                connected = true;
-                udev_device_unref(dev);
-                break;
-            }
-            udev_device_unref(dev);
+    const QString hid = supply.ancestors.value(QStringLiteral("hid"));
+    if (hid.isEmpty()) {
+        return;
+    }
+
+    GamepadController *controller = controllerForHid(hid);
+    if (action == UdevHub::Action::Removed) {
+        m_supplies.remove(hid);
+        if (controller) {
+            controller->clearBattery();
         }
+        return;
+    }
+
+    // Capacity changes arrive as change events with the new POWER_SUPPLY_CAPACITY
+    m_supplies.insert(hid, supply);
+    if (controller) {
+        controller->setBattery(supply);
     }
-    udev_enumerate_unref(enumerate);
-    m_sensor->setState(connected);
 }
+
 void setupGamepad()
 {
     new Gamepad(qApp);
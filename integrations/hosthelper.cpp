@@ -0,0 +1,149 @@
+// SPDX-FileCopyrightText: 2025 David Edmundson <davidedmundson@kde.org>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "hosthelper.h"
+
+#include <QCoreApplication>
+#include <QProcess>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(hosthelper)
+Q_LOGGING_CATEGORY(hosthelper, "integration.HostHelper")
+
+// Keep in sync with the head -c below. One reply line has to stay below PIPE_BUF
+// so replies of commands finishing at the same time don't interleave.
+static constexpr int s_maxOutput = 2048;
+
+// Requests are "<id> <timeout> <shell quoted command>", replies "<id> <exit code> <base64 stdout>".
+// Every request runs in its own background subshell, so slow commands don't block others.
+// When kiot goes away stdin closes and the loop ends, commands still running are left alone.
+static const char s_loop[] = R"(
+while IFS=' ' read -r id timeout cmd; do
+    (
+        tmp=$(mktemp) || { printf '%s 127 \n' "$id"; exit; }
+        if [ "$timeout" -gt 0 ]; then
+            timeout -k 2 "$timeout" sh -c "$cmd" >"$tmp" </dev/null
+        else
+            sh -c "$cmd" >"$tmp" </dev/null
+        fi
+        rc=$?
+        out=$(head -c 2048 "$tmp" | base64 | tr -d '\n')
+        rm -f "$tmp"
+        printf '%s %s %s\n' "$id" "$rc" "$out"
+    ) &
+done
+)";
+
+static QString shellQuote(const QString &arg)
+{
+    QString quoted = arg;
+    quoted.replace(QLatin1Char('\''), QLatin1String("'\\''"));
+    return QLatin1Char('\'') + quoted + QLatin1Char('\'');
+}
+
+HostHelper *HostHelper::self()
+{
+    static HostHelper *s_self = new HostHelper(qApp);
+    return s_self;
+}
+
+HostHelper::HostHelper(QObject *parent)
+    : QObject(parent)
+{
+}
+
+HostHelper::~HostHelper()
+{
+    if (m_helper) {
+        // Closing stdin ends the loop on the host
+        disconnect(m_helper, nullptr, this, nullptr);
+        m_helper->closeWriteChannel();
+        m_helper->waitForFinished(500);
+    }
+}
+
+bool HostHelper::ensureStarted()
+{
+    if (m_helper && m_helper->state() != QProcess::NotRunning) {
+        return true;
+    }
+    if (m_helper) {
+        // May be called from within one of its signals, see onHelperFinished()
+        disconnect(m_helper, nullptr, this, nullptr);
+        m_helper->deleteLater();
+    }
+
+    m_helper = new QProcess(this);
+    m_helper->setProgram(QStringLiteral("flatpak-spawn"));
+    m_helper->setArguments({QStringLiteral("--host"), QStringLiteral("sh"), QStringLiteral("-c"), QString::fromLatin1(s_loop)});
+    m_helper->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    connect(m_helper, &QProcess::readyReadStandardOutput, this, &HostHelper::onReadyRead);
+    connect(m_helper, &QProcess::finished, this, &HostHelper::onHelperFinished);
+    m_helper->start();
+    if (!m_helper->waitForStarted()) {
+        qCWarning(hosthelper) << "Failed to start host helper:" << m_helper->errorString();
+        return false;
+    }
+    qCDebug(hosthelper) << "Host helper started";
+    return true;
+}
+
+bool HostHelper::run(const QStringList &argv, int timeout, QObject *context, const Callback &callback)
+{
+    QStringList quoted;
+    for (const QString &arg : argv) {
+        // The protocol is line based
+        if (arg.contains(QLatin1Char('\n'))) {
+            return false;
+        }
+        quoted.append(shellQuote(arg));
+    }
+    if (quoted.isEmpty() || !ensureStarted()) {
+        return false;
+    }
+
+    const quint64 id = m_nextRequest++;
+    m_requests.insert(id, {context, callback});
+    const QString request = QStringLiteral("%1 %2 %3\n").arg(id).arg(qMax(0, timeout)).arg(quoted.join(QLatin1Char(' ')));
+    m_helper->write(request.toUtf8());
+    return true;
+}
+
+void HostHelper::onReadyRead()
+{
+    m_buffer.append(m_helper->readAllStandardOutput());
+    qsizetype newline;
+    while ((newline = m_buffer.indexOf('\n')) >= 0) {
+        const QByteArray line = m_buffer.left(newline);
+        m_buffer.remove(0, newline + 1);
+
+        const QList<QByteArray> parts = line.split(' ');
+        if (parts.size() < 2) {
+            qCWarning(hosthelper) << "Malformed reply from host helper:" << line;
+            continue;
+        }
+        const Request request = m_requests.take(parts[0].toULongLong());
+        if (!request.context || !request.callback) {
+            continue;
+        }
+        const QByteArray output = parts.size() > 2 ? QByteArray::fromBase64(parts[2]).left(s_maxOutput) : QByteArray();
+        request.callback(parts[1].toInt(), output);
+    }
+}
+
+void HostHelper::onHelperFinished()
+{
+    qCWarning(hosthelper) << "Host helper exited, it is restarted on the next command";
+    // Detach before the callbacks, they can send the next command and start a new helper
+    // while we're still inside the old one's finished signal
+    disconnect(m_helper, nullptr, this, nullptr);
+    m_helper->deleteLater();
+    m_helper = nullptr;
+    m_buffer.clear();
+    const auto requests = std::exchange(m_requests, {});
+    for (const Request &request : requests) {
+        if (request.context && request.callback) {
+            request.callback(-1, QByteArray());
+        }
+    }
+}
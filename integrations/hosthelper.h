@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2025 David Edmundson <davidedmundson@kde.org>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+
+#include <functional>
+
+class QProcess;
+
+// Inside Flatpak every command on the host goes through flatpak-spawn and a portal
+// round trip. The helper is one long lived shell on the host, started on first use,
+// that runs commands sent over its stdin and reports back on its stdout.
+
+class HostHelper : public QObject
+{
+    Q_OBJECT
+public:
+    // exitCode is -1 when the helper went away before the command finished.
+    // output is the start of the command's stdout, see s_maxOutput.
+    using Callback = std::function<void(int exitCode, const QByteArray &output)>;
+
+    static HostHelper *self();
+
+    // Commands are killed after timeout seconds when it's above 0, timeout(1) then reports 124.
+    // Returns false if the command can't be sent, the callback isn't called then.
+    bool run(const QStringList &argv, int timeout, QObject *context, const Callback &callback);
+
+private:
+    explicit HostHelper(QObject *parent);
+    ~HostHelper() override;
+
+    bool ensureStarted();
+    void onReadyRead();
+    void onHelperFinished();
+
+    struct Request {
+        QPointer<QObject> context;
+        Callback callback;
+    };
+
+    QProcess *m_helper = nullptr;
+    QByteArray m_buffer;
+    QHash<quint64, Request> m_requests;
+    quint64 m_nextRequest = 1;
+};
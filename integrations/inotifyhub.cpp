@@ -0,0 +1,195 @@
+// SPDX-FileCopyrightText: 2025 David Edmundson <davidedmundson@kde.org>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// SPDX-FileCopyrightText: 1998 Sven Radej <sven@lisa.exp.univie.ac.at>
+//      SPDX-FileCopyrightText: 2006 Dirk Mueller <mueller@kde.org>
+//          SPDX-FileCopyrightText: 2007 Flavio Castelli <flavio.castelli@gmail.com>
+
+#include "inotifyhub.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(inotifyhub)
+Q_LOGGING_CATEGORY(inotifyhub, "integration.InotifyHub")
+
+InotifyHub *InotifyHub::self()
+{
+    static InotifyHub *s_self = new InotifyHub(qApp);
+    return s_self;
+}
+
+InotifyHub::InotifyHub(QObject *parent)
+    : QObject(parent)
+{
+    m_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (m_fd == -1) {
+        qCWarning(inotifyhub) << "Failed to create inotify instance:" << strerror(errno);
+        return;
+    }
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &InotifyHub::onActivated);
+}
+
+InotifyHub::~InotifyHub()
+{
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+int InotifyHub::subscribe(const QString &path, uint32_t mask, QObject *context, const Callback &callback)
+{
+    if (m_fd == -1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // IN_MASK_ADD extends an existing watch on the same inode instead of replacing its mask
+    const int wd = inotify_add_watch(m_fd, QFile::encodeName(path).constData(), mask | IN_MASK_ADD);
+    if (wd == -1) {
+        return -1;
+    }
+
+    Watch &watch = m_watches[wd];
+    if (watch.path.isEmpty()) {
+        watch.path = path;
+    }
+    watch.mask |= mask;
+
+    const int id = m_nextSubscription++;
+    // Disconnected again on unsubscribe, long lived contexts would collect these otherwise
+    const QMetaObject::Connection contextConnection = connect(context, &QObject::destroyed, this, [this, id]() {
+        unsubscribe(id);
+    });
+    m_subscriptions.insert(id, {wd, mask, context, callback, contextConnection});
+    watch.subscriptions.append(id);
+    return id;
+}
+
+void InotifyHub::unsubscribe(int subscription)
+{
+    auto it = m_subscriptions.find(subscription);
+    if (it == m_subscriptions.end()) {
+        return;
+    }
+    const int wd = it->wd;
+    disconnect(it->contextConnection);
+    m_subscriptions.erase(it);
+
+    auto watchIt = m_watches.find(wd);
+    if (watchIt == m_watches.end()) {
+        return;
+    }
+    watchIt->subscriptions.removeOne(subscription);
+    if (watchIt->subscriptions.isEmpty()) {
+        inotify_rm_watch(m_fd, wd);
+        m_watches.erase(watchIt);
+        return;
+    }
+
+    // Shrink the kernel mask to what the remaining subscribers still need
+    uint32_t mask = 0;
+    for (int id : std::as_const(watchIt->subscriptions)) {
+        mask |= m_subscriptions.value(id).mask;
+    }
+    if (mask != watchIt->mask) {
+        watchIt->mask = mask;
+        inotify_add_watch(m_fd, QFile::encodeName(watchIt->path).constData(), mask);
+    }
+}
+
+void InotifyHub::onActivated()
+{
+    int pending = -1;
+    int offsetStartRead = 0; // where we read into buffer
+    char buf[8192];
+    ioctl(m_fd, FIONREAD, &pending);
+
+    // copied from KDirWatchPrivate::processInotifyEvents
+    while (pending > 0) {
+        const int bytesToRead = qMin<int>(pending, sizeof(buf) - offsetStartRead);
+
+        int bytesAvailable = read(m_fd, &buf[offsetStartRead], bytesToRead);
+        if (bytesAvailable <= 0) {
+            break;
+        }
+        pending -= bytesAvailable;
+        bytesAvailable += offsetStartRead;
+        offsetStartRead = 0;
+
+        int offsetCurrent = 0;
+        while (bytesAvailable >= int(sizeof(struct inotify_event))) {
+            const struct inotify_event *const event = reinterpret_cast<inotify_event *>(&buf[offsetCurrent]);
+
+            const int eventSize = sizeof(struct inotify_event) + event->len;
+            if (bytesAvailable < eventSize) {
+                break;
+            }
+
+            bytesAvailable -= eventSize;
+            offsetCurrent += eventSize;
+
+            dispatch(event);
+        }
+        if (bytesAvailable > 0) {
+            // copy partial event to beginning of buffer
+            memmove(buf, &buf[offsetCurrent], bytesAvailable);
+            offsetStartRead = bytesAvailable;
+        }
+    }
+}
+
+void InotifyHub::dispatch(const inotify_event *event)
+{
+    // Queue overflow has no watch descriptor, everyone needs to resync
+    if (event->mask & IN_Q_OVERFLOW) {
+        qCWarning(inotifyhub) << "inotify queue overflow";
+        const auto subscriptions = m_subscriptions;
+        for (const Subscription &subscription : subscriptions) {
+            if (subscription.context) {
+                subscription.callback(event);
+            }
+        }
+        return;
+    }
+
+    auto watchIt = m_watches.constFind(event->wd);
+    if (watchIt == m_watches.constEnd()) {
+        return;
+    }
+
+    // Callbacks may subscribe or unsubscribe, iterate over a copy
+    const QList<int> ids = watchIt->subscriptions;
+    for (int id : ids) {
+        auto it = m_subscriptions.constFind(id);
+        if (it == m_subscriptions.constEnd() || !it->context) {
+            continue;
+        }
+        if ((event->mask & it->mask) || (event->mask & IN_IGNORED)) {
+            const Callback callback = it->callback;
+            callback(event);
+        }
+    }
+
+    if (event->mask & IN_IGNORED) {
+        dropWatch(event->wd);
+    }
+}
+
+void InotifyHub::dropWatch(int wd)
+{
+    // The kernel already removed the watch, just forget about it
+    const Watch watch = m_watches.take(wd);
+    for (int id : watch.subscriptions) {
+        disconnect(m_subscriptions.take(id).contextConnection);
+    }
+}
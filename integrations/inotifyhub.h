@@ -0,0 +1,60 @@
+// SPDX-FileCopyrightText: 2025 David Edmundson <davidedmundson@kde.org>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+
+#include <functional>
+#include <sys/inotify.h>
+
+class QSocketNotifier;
+
+// One inotify instance shared by every integration watching files or device nodes.
+// Watches are refcounted, subscribing twice to the same path shares the kernel watch
+// and events are dispatched by watch descriptor.
+
+class InotifyHub : public QObject
+{
+    Q_OBJECT
+public:
+    using Callback = std::function<void(const inotify_event *event)>;
+
+    static InotifyHub *self();
+
+    // Returns a subscription id, or -1 with errno set when the path can't be watched.
+    // The subscription is dropped automatically when context is destroyed.
+    // IN_IGNORED and IN_Q_OVERFLOW are always delivered, after IN_IGNORED the subscription is gone.
+    int subscribe(const QString &path, uint32_t mask, QObject *context, const Callback &callback);
+    void unsubscribe(int subscription);
+
+private:
+    explicit InotifyHub(QObject *parent);
+    ~InotifyHub() override;
+
+    void onActivated();
+    void dispatch(const inotify_event *event);
+    void dropWatch(int wd);
+
+    struct Subscription {
+        int wd = -1;
+        uint32_t mask = 0;
+        QPointer<QObject> context;
+        Callback callback;
+        QMetaObject::Connection contextConnection;
+    };
+    struct Watch {
+        QString path;
+        uint32_t mask = 0;
+        QList<int> subscriptions;
+    };
+
+    int m_fd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QHash<int, Watch> m_watches; // by watch descriptor
+    QHash<int, Subscription> m_subscriptions;
+    int m_nextSubscription = 1;
+};
@@ -0,0 +1,180 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Every KWin backed integration is fed from this script, see kwinscript.h.
+// Events are queued per handler and sent in one DBus call, and an event is only
+// queued when it differs from the last one of its type.
+
+var pending = [];
+var lastSent = {};
+var currentWindow = null;
+var windowCount = 0;
+var watchedDesktops = [];
+
+function queue(type, data) {
+    var serialised = JSON.stringify(data);
+    if (lastSent[type] === serialised) return;
+    lastSent[type] = serialised;
+    data.type = type;
+    pending.push(data);
+}
+
+function flush() {
+    if (pending.length === 0) return;
+    callDBus('org.davidedmundson.kiot.KWin', '/KWin', 'org.davidedmundson.kiot.KWin', 'Events', JSON.stringify(pending));
+    pending = [];
+}
+
+// ==== Active window ====
+
+function queueActiveWindow(w) {
+    if (!w) return;
+    if (w.transient && w.transientFor) w = w.transientFor;
+
+    queue('activeWindow', {
+        title: w.caption || '',
+        resourceClass: w.resourceClass || '',
+        fullscreen: w.fullScreen.toString(),
+        screen: w.output.manufacturer,
+        x: w.x,
+        y: w.y,
+        width: w.width,
+        height: w.height,
+        pid: w.pid
+    });
+    queue('fullscreen', {
+        active: w.fullScreen,
+        resourceClass: w.resourceClass || ''
+    });
+}
+
+function onWindowChanged() {
+    queueActiveWindow(currentWindow);
+    flush();
+}
+
+function onGeometryChanged() {
+    // Dragging or resizing changes the geometry every frame, the final geometry
+    // is sent once from interactiveMoveResizeFinished
+    if (currentWindow && (currentWindow.move || currentWindow.resize)) return;
+    onWindowChanged();
+}
+
+function watchWindow(w) {
+    if (!w) return;
+
+    if (currentWindow) {
+        currentWindow.captionChanged.disconnect(onWindowChanged);
+        currentWindow.frameGeometryChanged.disconnect(onGeometryChanged);
+        currentWindow.interactiveMoveResizeFinished.disconnect(onWindowChanged);
+        currentWindow.fullScreenChanged.disconnect(onWindowChanged);
+        currentWindow.outputChanged.disconnect(onWindowChanged);
+    }
+
+    currentWindow = w;
+    currentWindow.captionChanged.connect(onWindowChanged);
+    currentWindow.frameGeometryChanged.connect(onGeometryChanged);
+    currentWindow.interactiveMoveResizeFinished.connect(onWindowChanged);
+    currentWindow.fullScreenChanged.connect(onWindowChanged);
+    currentWindow.outputChanged.connect(onWindowChanged);
+
+    queueActiveWindow(currentWindow);
+}
+
+function onWindowActivated(w) {
+    watchWindow(w);
+    flush();
+}
+
+// ==== Window count ====
+
+function isCounted(w) {
+    return w.normalWindow && !w.skipTaskbar;
+}
+
+function onWindowAdded(w) {
+    if (!isCounted(w)) return;
+    windowCount++;
+    queue('windowCount', { count: windowCount });
+    flush();
+}
+
+function onWindowRemoved(w) {
+    if (!isCounted(w)) return;
+    windowCount = Math.max(0, windowCount - 1);
+    queue('windowCount', { count: windowCount });
+    flush();
+}
+
+// ==== Virtual desktops ====
+
+function queueDesktop() {
+    var desktops = [];
+    for (var i = 0; i < workspace.desktops.length; i++) {
+        desktops.push({ id: workspace.desktops[i].id, name: workspace.desktops[i].name });
+    }
+    var current = workspace.currentDesktop;
+    queue('desktop', {
+        id: current ? current.id : '',
+        name: current ? current.name : '',
+        desktops: desktops
+    });
+}
+
+function onDesktopChanged() {
+    queueDesktop();
+    flush();
+}
+
+function watchDesktops() {
+    for (var i = 0; i < watchedDesktops.length; i++) {
+        watchedDesktops[i].nameChanged.disconnect(onDesktopChanged);
+    }
+    watchedDesktops = workspace.desktops.slice();
+    for (var j = 0; j < watchedDesktops.length; j++) {
+        watchedDesktops[j].nameChanged.connect(onDesktopChanged);
+    }
+}
+
+function onDesktopsChanged() {
+    watchDesktops();
+    onDesktopChanged();
+}
+
+// ==== Activities ====
+
+function queueActivity() {
+    queue('activity', {
+        id: workspace.currentActivity,
+        activities: workspace.activities
+    });
+}
+
+function onActivityChanged() {
+    queueActivity();
+    flush();
+}
+
+// ==== Setup ====
+
+var windows = workspace.windowList();
+for (var k = 0; k < windows.length; k++) {
+    if (isCounted(windows[k])) windowCount++;
+}
+queue('windowCount', { count: windowCount });
+
+workspace.windowAdded.connect(onWindowAdded);
+workspace.windowRemoved.connect(onWindowRemoved);
+workspace.currentDesktopChanged.connect(onDesktopChanged);
+workspace.desktopsChanged.connect(onDesktopsChanged);
+workspace.currentActivityChanged.connect(onActivityChanged);
+workspace.activityAdded.connect(onActivityChanged);
+workspace.activityRemoved.connect(onActivityChanged);
+workspace.windowActivated.connect(onWindowActivated);
+
+// Initial state of every stream goes out in one call
+watchDesktops();
+queueDesktop();
+queueActivity();
+watchWindow(workspace.activeWindow);
+flush();
@@ -0,0 +1,146 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "kwinscript.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusInterface>
+#include <QDBusMessage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <QTimer>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(kwinscript)
+Q_LOGGING_CATEGORY(kwinscript, "integration.KWinScript")
+
+static const QString s_scriptName = QStringLiteral("kiot");
+
+KWinScript *KWinScript::self()
+{
+    static KWinScript *s_self = new KWinScript(qApp);
+    return s_self;
+}
+
+KWinScript::KWinScript(QObject *parent)
+    : QObject(parent)
+{
+}
+
+KWinScript::~KWinScript()
+{
+    unload();
+}
+
+void KWinScript::subscribe(const QString &type, QObject *context, const Callback &callback)
+{
+    m_subscriptions[type].append({context, callback});
+
+    auto last = m_lastEvents.constFind(type);
+    if (last != m_lastEvents.constEnd()) {
+        callback(*last);
+    }
+
+    // Integrations are set up one after the other, load once all of them subscribed
+    if (!m_loadScheduled) {
+        m_loadScheduled = true;
+        QTimer::singleShot(0, this, &KWinScript::load);
+    }
+}
+
+void KWinScript::Events(const QString &events)
+{
+    const QJsonArray array = QJsonDocument::fromJson(events.toUtf8()).array();
+    for (const QJsonValue &value : array) {
+        QVariantMap event = value.toObject().toVariantMap();
+        const QString type = event.take(QStringLiteral("type")).toString();
+        m_lastEvents.insert(type, event);
+
+        auto it = m_subscriptions.find(type);
+        if (it == m_subscriptions.end()) {
+            continue;
+        }
+        it->removeIf([](const Subscription &subscription) {
+            return !subscription.context;
+        });
+        // Callbacks may subscribe, iterate over a copy
+        const QList<Subscription> subscriptions = *it;
+        for (const Subscription &subscription : subscriptions) {
+            subscription.callback(event);
+        }
+    }
+}
+
+void KWinScript::load()
+{
+    if (!tryLoad()) {
+        m_failed = true;
+        Q_EMIT loadFailed();
+    }
+}
+
+bool KWinScript::tryLoad()
+{
+    if (!QDBusConnection::sessionBus().registerService(QStringLiteral("org.davidedmundson.kiot.KWin"))) {
+        qCWarning(kwinscript) << "Failed to register DBus service";
+        return false;
+    }
+    if (!QDBusConnection::sessionBus().registerObject(QStringLiteral("/KWin"), QStringLiteral("org.davidedmundson.kiot.KWin"), this, QDBusConnection::ExportScriptableSlots)) {
+        qCWarning(kwinscript) << "Failed to register DBus object";
+        return false;
+    }
+
+    m_kwinIface = new QDBusInterface("org.kde.KWin", "/Scripting", "org.kde.kwin.Scripting", QDBusConnection::sessionBus(), this);
+    if (!m_kwinIface->isValid()) {
+        qCWarning(kwinscript) << "KWin scripting interface not available";
+        return false;
+    }
+
+    // Clean up any existing instance, including the script older versions loaded for ActiveWindow
+    m_kwinIface->call("unloadScript", s_scriptName);
+    m_kwinIface->call("unloadScript", "kiot_activewindow");
+
+    // Locate installed KWin script from KDE data dirs
+    const QString scriptPath = QStandardPaths::locate(QStandardPaths::GenericDataLocation, QStringLiteral("kiot/kiot_kwin.js"));
+    if (scriptPath.isEmpty()) {
+        qCWarning(kwinscript) << "installed KWin script not found in data dirs";
+        return false;
+    }
+
+    QDBusMessage reply = m_kwinIface->call("loadScript", scriptPath, s_scriptName);
+    if (reply.type() == QDBusMessage::ErrorMessage) {
+        qCWarning(kwinscript) << "loadScript failed:" << reply.errorMessage();
+        return false;
+    }
+    if (reply.arguments().isEmpty() || !reply.arguments().first().canConvert<int>()) {
+        qCWarning(kwinscript) << "Unexpected reply from loadScript:" << reply.arguments();
+        return false;
+    }
+
+    // KWin returns an int for the script ID in all supported versions
+    const QString scriptObjectPath = QString("/Scripting/Script%1").arg(reply.arguments().first().toInt());
+    QDBusInterface scriptIface("org.kde.KWin", scriptObjectPath, "org.kde.kwin.Script", QDBusConnection::sessionBus());
+    if (!scriptIface.isValid()) {
+        qCWarning(kwinscript) << "scriptIface invalid for path" << scriptObjectPath;
+        return false;
+    }
+
+    QDBusMessage runReply = scriptIface.call("run");
+    if (runReply.type() == QDBusMessage::ErrorMessage) {
+        qCWarning(kwinscript) << "run failed:" << runReply.errorMessage();
+        return false;
+    }
+    m_loaded = true;
+    return true;
+}
+
+void KWinScript::unload()
+{
+    if (m_loaded && m_kwinIface) {
+        m_kwinIface->call("unloadScript", s_scriptName);
+        m_loaded = false;
+    }
+}
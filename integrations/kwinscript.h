@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QVariantMap>
+
+#include <functional>
+
+class QDBusInterface;
+
+// The one KWin script kiot loads. It sends batches of events over a single DBus
+// method, integrations subscribe to the event types they care about here.
+//
+// Event types: activeWindow, fullscreen, windowCount, desktop, activity
+
+class KWinScript : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.davidedmundson.kiot.KWin")
+
+public:
+    using Callback = std::function<void(const QVariantMap &event)>;
+
+    static KWinScript *self();
+
+    // The last event of that type is replayed right away if there was one.
+    // The script is loaded on the next event loop turn after the first subscription.
+    // The subscription is dropped automatically when context is destroyed.
+    void subscribe(const QString &type, QObject *context, const Callback &callback);
+
+    // True once loading failed, e.g. not a KWin session. No events will arrive then
+    bool hasFailed() const
+    {
+        return m_failed;
+    }
+
+Q_SIGNALS:
+    void loadFailed();
+
+public Q_SLOTS:
+    // Called by the script, a JSON array of objects each with a "type" member
+    Q_SCRIPTABLE void Events(const QString &events);
+
+private:
+    explicit KWinScript(QObject *parent);
+    ~KWinScript() override;
+
+    void load();
+    bool tryLoad();
+    void unload();
+
+    struct Subscription {
+        QPointer<QObject> context;
+        Callback callback;
+    };
+
+    QDBusInterface *m_kwinIface = nullptr;
+    QHash<QString, QList<Subscription>> m_subscriptions;
+    QHash<QString, QVariantMap> m_lastEvents;
+    bool m_loadScheduled = false;
+    bool m_loaded = false;
+    bool m_failed = false;
+};
@@ -0,0 +1,152 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "core.h"
+#include "entities/entities.h"
+
+#include <PulseAudioQt/Client>
+#include <PulseAudioQt/Context>
+#include <PulseAudioQt/Source>
+#include <PulseAudioQt/SourceOutput>
+
+#include <QCoreApplication>
+#include <QTimer>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(mic)
+Q_LOGGING_CATEGORY(mic, "integration.Microphone")
+
+// Volume meters record from sources too, they don't mean anyone is listening
+static const QStringList s_ignoredApplicationIds = {
+    QStringLiteral("org.davidedmundson.kiot"),
+    QStringLiteral("org.kde.plasma-pa"),
+    QStringLiteral("org.PulseAudio.pavucontrol"),
+};
+
+class MicrophoneWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MicrophoneWatcher(QObject *parent = nullptr);
+
+private:
+    void onSourceOutputAdded(PulseAudioQt::SourceOutput *output);
+    bool isMicrophoneUser(const PulseAudioQt::SourceOutput *output) const;
+    void updateSensorState();
+    void publishApplications();
+
+    PulseAudioQt::Context *m_ctx = nullptr;
+    BinarySensor *m_sensor = nullptr;
+    QTimer *m_updateTimer = nullptr;
+    QTimer *m_hysterisisDelay = nullptr;
+    QVariantList m_applications;
+};
+
+MicrophoneWatcher::MicrophoneWatcher(QObject *parent)
+    : QObject(parent)
+    , m_updateTimer(new QTimer(this))
+    , m_hysterisisDelay(new QTimer(this))
+{
+    m_sensor = new BinarySensor(this);
+    m_sensor->setId("microphone");
+    m_sensor->setName("Microphone Active");
+    m_sensor->setDiscoveryConfig("icon", "mdi:microphone");
+    m_sensor->setState(false);
+
+    // Same delay as the camera, so applications probing the device don't flap the sensor
+    m_hysterisisDelay->setInterval(1000);
+    m_hysterisisDelay->setSingleShot(true);
+    connect(m_hysterisisDelay, &QTimer::timeout, this, [this]() {
+        // Probes shorter than the delay never reach HA, neither the state nor the attribute
+        publishApplications();
+        m_sensor->setState(true);
+    });
+
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(0);
+    connect(m_updateTimer, &QTimer::timeout, this, &MicrophoneWatcher::updateSensorState);
+
+    m_ctx = PulseAudioQt::Context::instance();
+    if (!m_ctx || !m_ctx->isValid()) {
+        qCWarning(mic) << "PulseAudio context not valid";
+        return;
+    }
+
+    connect(m_ctx, &PulseAudioQt::Context::sourceOutputAdded, this, &MicrophoneWatcher::onSourceOutputAdded);
+    connect(m_ctx, &PulseAudioQt::Context::sourceOutputRemoved, m_updateTimer, qOverload<>(&QTimer::start));
+    for (auto *output : m_ctx->sourceOutputs()) {
+        onSourceOutputAdded(output);
+    }
+}
+
+void MicrophoneWatcher::onSourceOutputAdded(PulseAudioQt::SourceOutput *output)
+{
+    // Streams can be moved between a microphone and a monitor source
+    connect(output, &PulseAudioQt::Stream::deviceIndexChanged, m_updateTimer, qOverload<>(&QTimer::start));
+    m_updateTimer->start();
+}
+
+bool MicrophoneWatcher::isMicrophoneUser(const PulseAudioQt::SourceOutput *output) const
+{
+    const QVariantMap props = output->properties();
+    if (s_ignoredApplicationIds.contains(props.value(QStringLiteral("application.id")).toString())) {
+        return false;
+    }
+
+    for (const auto *source : m_ctx->sources()) {
+        if (source->index() == output->deviceIndex()) {
+            return source->properties().value(QStringLiteral("device.class")).toString() != QLatin1String("monitor");
+        }
+    }
+    return false;
+}
+
+void MicrophoneWatcher::updateSensorState()
+{
+    QVariantList applications;
+    for (const auto *output : m_ctx->sourceOutputs()) {
+        if (!isMicrophoneUser(output)) {
+            continue;
+        }
+        const QVariantMap props = output->properties();
+        QString name = props.value(QStringLiteral("application.name")).toString();
+        if (name.isEmpty() && output->client()) {
+            name = output->client()->name();
+        }
+        QVariantMap app;
+        app["name"] = name;
+        app["pid"] = props.value(QStringLiteral("application.process.id")).toString();
+        applications.append(app);
+    }
+
+    m_applications = applications;
+
+    if (applications.isEmpty()) {
+        m_hysterisisDelay->stop();
+        m_sensor->setState(false);
+        if (!m_sensor->attributes().isEmpty()) {
+            m_sensor->setAttributes({});
+        }
+    } else if (m_sensor->state()) {
+        publishApplications();
+    } else if (!m_hysterisisDelay->isActive()) {
+        m_hysterisisDelay->start();
+    }
+}
+
+void MicrophoneWatcher::publishApplications()
+{
+    QVariantMap attributes;
+    attributes["applications"] = m_applications;
+    if (m_sensor->attributes() != attributes) {
+        m_sensor->setAttributes(attributes);
+    }
+}
+
+void setupMicrophone()
+{
+    new MicrophoneWatcher(qApp);
+}
+
+REGISTER_INTEGRATION("MicrophoneWatcher", setupMicrophone, true)
+#include "microphone.moc"
@@ -3,6 +3,7 @@
 
 #include "core.h"
 #include "entities/entities.h"
+#include "hosthelper.h"
 #include <KConfigGroup>
 #include <KProcess>
 #include <KSharedConfig>
@@ -10,55 +11,437 @@
 
 #include <QAction>
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQueue>
+#include <QRegularExpression>
+#include <QTimer>
 
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(scripts)
 Q_LOGGING_CATEGORY(scripts, "integration.Scripts")
 
+// Only the start of stdout goes into the result attributes, the rest is drained and dropped
+static constexpr qsizetype s_maxOutput = 1024;
+// Presses waiting for a free slot with Policy=queue, anything beyond is dropped
+static constexpr int s_maxQueued = 8;
+// Grace period between SIGTERM and SIGKILL for timed out or restarted scripts
+static constexpr int s_killGrace = 2000;
+// Stream=true publishes the latest line of output at most this often
+static constexpr int s_streamInterval = 1000;
+// HA rejects longer states
+static constexpr int s_maxStateLength = 255;
+
+// Replaces {payload} with the MQTT payload and {json.a.b} with a field of it parsed as JSON.
+// Substitution happens per argument after Exec was split, so payloads can't inject arguments.
+static QStringList substitutePayload(const QStringList &argv, const QByteArray &payload)
+{
+    static const QRegularExpression placeholder(QStringLiteral("\\{(payload|json(?:\\.[^}.]+)+)\\}"));
+    QStringList result;
+    result.reserve(argv.size());
+    QJsonObject json;
+    bool jsonParsed = false;
+    for (const QString &arg : argv) {
+        if (!arg.contains(QLatin1Char('{'))) {
+            result.append(arg);
+            continue;
+        }
+        QString substituted;
+        qsizetype last = 0;
+        auto it = placeholder.globalMatch(arg);
+        while (it.hasNext()) {
+            const QRegularExpressionMatch match = it.next();
+            substituted += arg.mid(last, match.capturedStart() - last);
+            last = match.capturedEnd();
+
+            const QString key = match.captured(1);
+            if (key == QLatin1String("payload")) {
+                substituted += QString::fromUtf8(payload);
+                continue;
+            }
+            if (!jsonParsed) {
+                json = QJsonDocument::fromJson(payload).object();
+                jsonParsed = true;
+            }
+            QJsonValue value = json;
+            const QStringList path = key.split(QLatin1Char('.')).mid(1);
+            for (const QString &field : path) {
+                value = value.toObject().value(field);
+            }
+            if (value.isString()) {
+                substituted += value.toString();
+            } else if (value.isDouble()) {
+                substituted += QString::number(value.toDouble());
+            } else if (value.isBool()) {
+                substituted += value.toBool() ? QStringLiteral("true") : QStringLiteral("false");
+            }
+        }
+        substituted += arg.mid(last);
+        result.append(substituted);
+    }
+    return result;
+}
+
+class ScriptRunner : public QObject
+{
+    Q_OBJECT
+public:
+    // What to do with a press while MaxConcurrent runs are active
+    enum class Policy {
+        Drop,
+        Queue,
+        Restart,
+    };
+
+    ScriptRunner(const QString &id, const KConfigGroup &config, bool useHostHelper, QObject *parent);
+    bool isValid() const;
+    void trigger(const QByteArray &payload);
+
+private:
+    struct Run {
+        QElapsedTimer clock;
+        QByteArray output;
+        bool timedOut = false;
+    };
+
+    int runningCount() const;
+    void start(const QByteArray &payload);
+    bool startOnHost(const QByteArray &payload);
+    void readOutput(QProcess *process);
+    void publishStreamLine();
+    void stop(QProcess *process);
+    void onFinished(QProcess *process, int exitCode, QProcess::ExitStatus exitStatus);
+    void publishResult(const QString &status, int exitCode, qint64 durationMs, const QByteArray &output);
+
+    QString m_id;
+    QString m_program;
+    QStringList m_arguments;
+    QStringList m_hostArgv; // set when commands go through the HostHelper
+    int m_hostRuns = 0;
+    Policy m_policy = Policy::Drop;
+    int m_maxConcurrent = 4;
+    int m_timeout = 0;
+    bool m_detached = false;
+    bool m_stream = false;
+    QQueue<QByteArray> m_queued; // payloads of presses waiting for a slot
+    QHash<QProcess *, Run> m_running;
+    QList<QProcess *> m_startOrder;
+    Button *m_button = nullptr;
+    Sensor *m_result = nullptr;
+    Sensor *m_output = nullptr;
+    QTimer *m_streamTimer = nullptr;
+    QString m_streamLine;
+};
+
+ScriptRunner::ScriptRunner(const QString &id, const KConfigGroup &config, bool useHostHelper, QObject *parent)
+    : QObject(parent)
+    , m_id(id)
+{
+    const QString name = config.readEntry("Name", id);
+    const QString exec = config.readEntry("Exec");
+    const QString icon = config.readEntry("icon", "mdi:script-text");
+
+    // Parsed once here rather than on every press
+    QStringList args = QProcess::splitCommand(exec);
+    if (args.isEmpty()) {
+        qCWarning(scripts) << "Could not parse script Exec entry for" << id;
+        return;
+    }
+    m_program = args.takeFirst();
+    m_arguments = args;
+
+    if (KSandbox::isFlatpak()) {
+        // Without a host helper, or when it can't be started, every run goes through flatpak-spawn
+        if (useHostHelper) {
+            m_hostArgv = QStringList{m_program} + m_arguments;
+        }
+        KProcess process;
+        process.setProgram(m_program);
+        process.setArguments(m_arguments);
+        const KSandbox::ProcessContext ctx = KSandbox::makeHostContext(process);
+        m_program = ctx.program;
+        m_arguments = ctx.arguments;
+    }
+
+    const QString policy = config.readEntry("Policy", "drop").toLower();
+    if (policy == QLatin1String("queue")) {
+        m_policy = Policy::Queue;
+    } else if (policy == QLatin1String("restart")) {
+        m_policy = Policy::Restart;
+    } else if (policy != QLatin1String("drop")) {
+        qCWarning(scripts) << "Unknown Policy" << policy << "for script" << id << ", using drop";
+    }
+    m_maxConcurrent = qMax(1, config.readEntry("MaxConcurrent", m_maxConcurrent));
+    m_timeout = qMax(0, config.readEntry("Timeout", 0)) * 1000;
+    // Launchers of applications that should outlive kiot, no result is reported for those.
+    // Scripts from before managed runs existed don't set any of the new keys and stay fire and forget
+    const bool managed = config.hasKey("Policy") || config.hasKey("MaxConcurrent") || config.hasKey("Timeout") || config.hasKey("Stream");
+    m_detached = config.readEntry("Detached", !managed);
+    // Progress of long running jobs, every line of stdout becomes the state of an output sensor
+    m_stream = !m_detached && config.readEntry("Stream", false);
+    if (m_stream) {
+        // Lines are read as they come, which the host helper can't do
+        m_hostArgv.clear();
+    }
+
+    m_button = new Button(this);
+    m_button->setId(id);
+    m_button->setName(name);
+    m_button->setDiscoveryConfig("icon", icon);
+    connect(m_button, &Button::triggered, this, &ScriptRunner::trigger);
+
+    if (!m_detached) {
+        m_result = new Sensor(this);
+        m_result->setId(id + "_result");
+        m_result->setName(name + " Result");
+        m_result->setDiscoveryConfig("icon", "mdi:script-text-play");
+    }
+
+    if (m_stream) {
+        m_output = new Sensor(this);
+        m_output->setId(id + "_output");
+        m_output->setName(name + " Output");
+        m_output->setDiscoveryConfig("icon", "mdi:text-box-outline");
+
+        // Not restarted per line, a chatty script still publishes once per interval
+        m_streamTimer = new QTimer(this);
+        m_streamTimer->setSingleShot(true);
+        m_streamTimer->setInterval(s_streamInterval);
+        connect(m_streamTimer, &QTimer::timeout, this, &ScriptRunner::publishStreamLine);
+    }
+}
+
+bool ScriptRunner::isValid() const
+{
+    return m_button;
+}
+
+void ScriptRunner::trigger(const QByteArray &payload)
+{
+    if (m_detached) {
+        qCInfo(scripts) << "Running script " << m_id;
+        if (m_hostArgv.isEmpty() || !HostHelper::self()->run(substitutePayload(m_hostArgv, payload), 0, this, nullptr)) {
+            QProcess::startDetached(m_program, substitutePayload(m_arguments, payload));
+        }
+        return;
+    }
+
+    if (runningCount() < m_maxConcurrent) {
+        start(payload);
+        return;
+    }
+
+    switch (m_policy) {
+    case Policy::Drop:
+        qCDebug(scripts) << "Script" << m_id << "already running, ignoring trigger";
+        break;
+    case Policy::Queue:
+        if (m_queued.size() < s_maxQueued) {
+            m_queued.enqueue(payload);
+        } else {
+            qCDebug(scripts) << "Script" << m_id << "queue full, ignoring trigger";
+        }
+        break;
+    case Policy::Restart:
+        // The new run starts as soon as the oldest one is gone, repeated presses collapse into one.
+        // Runs on the host helper can't be stopped early, the new run waits for them instead.
+        if (!m_startOrder.isEmpty())
+            stop(m_startOrder.first());
+        m_queued = {payload};
+        break;
+    }
+}
+
+int ScriptRunner::runningCount() const
+{
+    return m_running.size() + m_hostRuns;
+}
+
+void ScriptRunner::start(const QByteArray &payload)
+{
+    qCInfo(scripts) << "Running script " << m_id;
+    if (!m_hostArgv.isEmpty() && startOnHost(payload)) {
+        return;
+    }
+
+    auto *process = new QProcess(this);
+    process->setProgram(m_program);
+    process->setArguments(substitutePayload(m_arguments, payload));
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+
+    m_running.insert(process, Run());
+    m_startOrder.append(process);
+
+    connect(process, &QProcess::readyReadStandardOutput, this, [this, process]() {
+        readOutput(process);
+    });
+    connect(process, &QProcess::finished, this, [this, process](int exitCode, QProcess::ExitStatus exitStatus) {
+        onFinished(process, exitCode, exitStatus);
+    });
+    connect(process, &QProcess::errorOccurred, this, [this, process](QProcess::ProcessError error) {
+        // finished() follows for everything but a failed start
+        if (error == QProcess::FailedToStart) {
+            qCWarning(scripts) << "Script" << m_id << "failed to start:" << process->errorString();
+            onFinished(process, -1, QProcess::CrashExit);
+        }
+    });
+
+    if (m_timeout > 0) {
+        QTimer::singleShot(m_timeout, process, [this, process]() {
+            auto it = m_running.find(process);
+            if (it == m_running.end()) {
+                return;
+            }
+            qCWarning(scripts) << "Script" << m_id << "timed out";
+            it->timedOut = true;
+            stop(process);
+        });
+    }
+
+    m_running[process].clock.start();
+    process->start();
+}
+
+bool ScriptRunner::startOnHost(const QByteArray &payload)
+{
+    QElapsedTimer clock;
+    clock.start();
+    const int timeout = m_timeout / 1000;
+    const bool sent = HostHelper::self()->run(substitutePayload(m_hostArgv, payload), timeout, this, [this, clock, timeout](int exitCode, const QByteArray &output) {
+        --m_hostRuns;
+        QString status = QStringLiteral("exited");
+        if (exitCode < 0) {
+            status = QStringLiteral("failed");
+        } else if (timeout > 0 && (exitCode == 124 || exitCode == 137)) {
+            // What timeout(1) reports for a command it had to terminate or kill
+            status = QStringLiteral("timeout");
+        }
+        publishResult(status, exitCode, clock.elapsed(), output);
+    });
+    if (sent) {
+        ++m_hostRuns;
+    }
+    return sent;
+}
+
+void ScriptRunner::readOutput(QProcess *process)
+{
+    auto it = m_running.find(process);
+    if (it == m_running.end()) {
+        process->readAllStandardOutput();
+        return;
+    }
+
+    if (!m_stream) {
+        const QByteArray data = process->readAllStandardOutput();
+        if (it->output.size() < s_maxOutput) {
+            it->output.append(data.left(s_maxOutput - it->output.size()));
+        }
+        return;
+    }
+
+    // Only whole lines, a partial one stays in QProcess's buffer until the rest arrives
+    while (process->canReadLine()) {
+        const QByteArray line = process->readLine();
+        if (it->output.size() < s_maxOutput) {
+            it->output.append(line.left(s_maxOutput - it->output.size()));
+        }
+        const QString trimmed = QString::fromUtf8(line).trimmed();
+        if (!trimmed.isEmpty()) {
+            m_streamLine = trimmed.left(s_maxStateLength);
+        }
+    }
+    if (!m_streamLine.isEmpty() && !m_streamTimer->isActive()) {
+        m_streamTimer->start();
+    }
+}
+
+void ScriptRunner::publishStreamLine()
+{
+    if (!m_streamLine.isEmpty() && m_output->state() != m_streamLine) {
+        m_output->setState(m_streamLine);
+    }
+}
+
+void ScriptRunner::stop(QProcess *process)
+{
+    process->terminate();
+    QTimer::singleShot(s_killGrace, process, &QProcess::kill);
+}
+
+void ScriptRunner::onFinished(QProcess *process, int exitCode, QProcess::ExitStatus exitStatus)
+{
+    auto it = m_running.find(process);
+    if (it == m_running.end()) {
+        return;
+    }
+    if (m_stream) {
+        // The last line may have come without a newline
+        const QByteArray tail = process->readAllStandardOutput();
+        if (it->output.size() < s_maxOutput) {
+            it->output.append(tail.left(s_maxOutput - it->output.size()));
+        }
+        const QString rest = QString::fromUtf8(tail).trimmed();
+        if (!rest.isEmpty()) {
+            m_streamLine = rest.left(s_maxStateLength);
+        }
+        m_streamTimer->stop();
+        publishStreamLine();
+    }
+    const Run run = m_running.take(process);
+    m_startOrder.removeOne(process);
+    process->deleteLater();
+
+    QString status;
+    if (run.timedOut) {
+        status = QStringLiteral("timeout");
+    } else if (process->error() == QProcess::FailedToStart) {
+        status = QStringLiteral("failed");
+    } else if (exitStatus == QProcess::CrashExit) {
+        status = QStringLiteral("crashed");
+    } else {
+        status = QStringLiteral("exited");
+    }
+
+    publishResult(status, exitCode, run.clock.elapsed(), run.output);
+}
+
+void ScriptRunner::publishResult(const QString &status, int exitCode, qint64 durationMs, const QByteArray &output)
+{
+    QVariantMap attributes;
+    attributes["status"] = status;
+    attributes["duration_ms"] = durationMs;
+    attributes["output"] = QString::fromUtf8(output.left(s_maxOutput)).trimmed();
+    m_result->setState(status == QLatin1String("exited") ? QString::number(exitCode) : status);
+    m_result->setAttributes(attributes);
+
+    if (!m_queued.isEmpty() && runningCount() < m_maxConcurrent) {
+        start(m_queued.dequeue());
+    }
+}
+
 void registerScripts()
 {
     auto scriptConfigToplevel = KSharedConfig::openConfig()->group("Scripts");
     const QStringList scriptIds = scriptConfigToplevel.groupList();
+    // Inside Flatpak, run everything through one long lived shell on the host
+    const bool useHostHelper = scriptConfigToplevel.readEntry("UseHostHelper", false);
     for (const QString &scriptId : scriptIds) {
         auto scriptConfig = scriptConfigToplevel.group(scriptId);
-        const QString name = scriptConfig.readEntry("Name", scriptId);
-        const QString exec = scriptConfig.readEntry("Exec");
-        const QString icon = scriptConfig.readEntry("icon","mdi:script-text");
-        if (exec.isEmpty()) {
+        if (scriptConfig.readEntry("Exec").isEmpty()) {
             qCWarning(scripts) << "Could not find script Exec entry for" << scriptId;
             continue;
         }
 
-        auto button = new Button(qApp);
-        button->setId(scriptId);
-        button->setName(name);
-        button->setDiscoveryConfig("icon", icon);
-        // Home assistant integration supports payloads, which we could expose as args
-        // maybe via some substitution in the exec line
-        QObject::connect(button, &Button::triggered, qApp, [exec, scriptId]() {
-            qCInfo(scripts) << "Running script " << scriptId;
-            QStringList args = QProcess::splitCommand(exec); 
-            if (args.isEmpty()) {                            
-                qCWarning(scripts) << "Could not parse script Exec entry for" << scriptId;
-                return;
-            } 
-            QString program = args.takeFirst();           
-
-            KProcess *p = new KProcess();
-            p->setProgram(program);
-            p->setArguments(args);
-
-            if (KSandbox::isFlatpak()) {
-                KSandbox::ProcessContext ctx = KSandbox::makeHostContext(*p);
-                p->setProgram(ctx.program);
-                p->setArguments(ctx.arguments);
-            }
-
-            p->startDetached();
-            delete p;
-        });
+        auto runner = new ScriptRunner(scriptId, scriptConfig, useHostHelper, qApp);
+        if (!runner->isValid()) {
+            delete runner;
+        }
     }
     if( scriptIds.length() >= 1 )
         qCInfo(scripts) << "Loaded" << scriptIds.length() << " scripts:" << scriptIds.join(", ");
 }
 REGISTER_INTEGRATION("Scripts", registerScripts, true)
+
+#include "scripts.moc"
@@ -8,6 +8,73 @@
 #include <KSharedConfig>
 #include <QAction>
 #include <QCoreApplication>
+#include <QTimer>
+
+// Tells a short press from holding the shortcut down, using the release reported by kglobalacceld.
+// Not every setup reports presses and releases, until one was seen presses stay plain presses.
+class LongPressShortcut : public QObject
+{
+    Q_OBJECT
+public:
+    LongPressShortcut(QAction *action, Event *event, int longPressTime);
+
+private:
+    void onActiveChanged(QAction *action, bool active);
+    void onTriggered();
+
+    QAction *m_action = nullptr;
+    Event *m_event = nullptr;
+    QTimer *m_holdTimer = nullptr;
+    bool m_activeSeen = false;
+    bool m_releaseSeen = false;
+};
+
+LongPressShortcut::LongPressShortcut(QAction *action, Event *event, int longPressTime)
+    : QObject(action)
+    , m_action(action)
+    , m_event(event)
+    , m_holdTimer(new QTimer(this))
+{
+    m_holdTimer->setSingleShot(true);
+    m_holdTimer->setInterval(longPressTime);
+    // Fired while the keys are still held, no need to wait for the release. Without any release
+    // seen so far we can't tell a held shortcut from a missing release, so that is a press
+    connect(m_holdTimer, &QTimer::timeout, this, [this]() {
+        m_event->trigger(m_releaseSeen ? QStringLiteral("long_press") : QStringLiteral("press"));
+    });
+    connect(KGlobalAccel::self(), &KGlobalAccel::globalShortcutActiveChanged, this, &LongPressShortcut::onActiveChanged);
+    connect(m_action, &QAction::triggered, this, &LongPressShortcut::onTriggered);
+}
+
+void LongPressShortcut::onTriggered()
+{
+    if (m_activeSeen) {
+        return;
+    }
+    // The active notification comes from the same DBus signal, check again once it had its chance
+    QTimer::singleShot(0, this, [this]() {
+        if (!m_activeSeen) {
+            m_event->trigger();
+        }
+    });
+}
+
+void LongPressShortcut::onActiveChanged(QAction *action, bool active)
+{
+    if (action != m_action) {
+        return;
+    }
+    if (active) {
+        m_activeSeen = true;
+        m_holdTimer->start();
+        return;
+    }
+    m_releaseSeen = true;
+    if (m_holdTimer->isActive()) {
+        m_holdTimer->stop();
+        m_event->trigger(QStringLiteral("press"));
+    }
+}
 
 void registerShortcuts()
 {
@@ -24,8 +91,17 @@ void registerShortcuts()
         event->setName(name);
 
         KGlobalAccel::self()->setShortcut(action, {});
-        QObject::connect(action, &QAction::triggered, event, &Event::trigger);
+        if (shortcutConfig.readEntry("LongPress", false)) {
+            event->setEventTypes({QStringLiteral("press"), QStringLiteral("long_press")});
+            new LongPressShortcut(action, event, shortcutConfig.readEntry("LongPressTime", 500));
+        } else {
+            QObject::connect(action, &QAction::triggered, event, [event]() {
+                event->trigger();
+            });
+        }
     }
 }
 
 REGISTER_INTEGRATION("Shortcuts", registerShortcuts, true)
+
+#include "shortcuts.moc"
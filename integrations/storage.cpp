@@ -0,0 +1,326 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "core.h"
+#include "entities/entities.h"
+#include "udevhub.h"
+
+#include <Solid/Device>
+#include <Solid/DeviceNotifier>
+#include <Solid/OpticalDrive>
+#include <Solid/StorageAccess>
+#include <Solid/StorageDrive>
+#include <Solid/StorageVolume>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMap>
+#include <QRegularExpression>
+#include <QTimer>
+
+#include <sys/statvfs.h>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(storage)
+Q_LOGGING_CATEGORY(storage, "integration.Storage")
+
+// Free space is polled, filesystems don't tell us when they fill up
+static constexpr int s_freeSpaceInterval = 60 * 1000;
+// Republish free space once it moved by 1% of the volume, or 256 MiB on large disks
+static constexpr quint64 s_maxFreeSpaceThreshold = 256ull * 1024 * 1024;
+
+static Solid::Device driveForVolume(const Solid::Device &volume)
+{
+    Solid::Device parent = volume.parent();
+    while (parent.isValid() && !parent.is<Solid::StorageDrive>()) {
+        parent = parent.parent();
+    }
+    return parent;
+}
+
+static bool isRemovableVolume(const Solid::Device &device)
+{
+    if (!device.is<Solid::StorageVolume>() || !device.is<Solid::StorageAccess>()) {
+        return false;
+    }
+    if (device.as<Solid::StorageVolume>()->isIgnored()) {
+        return false;
+    }
+    const Solid::Device drive = driveForVolume(device);
+    const auto *storageDrive = drive.as<Solid::StorageDrive>();
+    return storageDrive && (storageDrive->isRemovable() || storageDrive->isHotpluggable());
+}
+
+class Storage : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Storage(QObject *parent = nullptr);
+
+private:
+    struct Volume {
+        Solid::Device device;
+        QString label;
+        QString mountPoint;
+        quint64 total = 0;
+        quint64 free = 0;
+        Button *eject = nullptr;
+    };
+
+    void onUsbDevice(UdevHub::Action action, const UdevDevice &device);
+    void deviceAdded(const QString &udi);
+    void deviceRemoved(const QString &udi);
+    void updateMountPoint(const QString &udi);
+    void sampleFreeSpace();
+    bool readFreeSpace(Volume &volume) const;
+    void eject(const QString &udi);
+    void flush();
+
+    Sensor *m_usbSensor = nullptr;
+    Sensor *m_volumeSensor = nullptr;
+    QMap<QString, QVariantMap> m_usbDevices; // syspath -> attributes
+    QHash<QString, Volume> m_volumes; // udi -> volume
+    QTimer *m_updateTimer = nullptr;
+    QTimer *m_freeSpaceTimer = nullptr;
+    bool m_usbDirty = false;
+    bool m_volumesDirty = false;
+};
+
+Storage::Storage(QObject *parent)
+    : QObject(parent)
+    , m_updateTimer(new QTimer(this))
+    , m_freeSpaceTimer(new QTimer(this))
+{
+    m_usbSensor = new Sensor(this);
+    m_usbSensor->setId("usb_devices");
+    m_usbSensor->setName("USB Devices");
+    m_usbSensor->setDiscoveryConfig("icon", "mdi:usb");
+    m_usbSensor->setDiscoveryConfig("state_class", "measurement");
+
+    m_volumeSensor = new Sensor(this);
+    m_volumeSensor->setId("removable_volumes");
+    m_volumeSensor->setName("Removable Volumes");
+    m_volumeSensor->setDiscoveryConfig("icon", "mdi:harddisk");
+    m_volumeSensor->setDiscoveryConfig("state_class", "measurement");
+
+    // Plugging a device in produces a burst of udev and Solid events, publish once per event loop turn
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(0);
+    connect(m_updateTimer, &QTimer::timeout, this, &Storage::flush);
+
+    m_freeSpaceTimer->setInterval(s_freeSpaceInterval);
+    connect(m_freeSpaceTimer, &QTimer::timeout, this, &Storage::sampleFreeSpace);
+    m_freeSpaceTimer->start();
+
+    // Root hubs and interfaces are filtered out in onUsbDevice
+    UdevFilter usb;
+    usb.subsystem = QStringLiteral("usb");
+    usb.devtype = QStringLiteral("usb_device");
+    UdevHub::self()->subscribe(usb, this, [this](UdevHub::Action action, const UdevDevice &device) {
+        onUsbDevice(action, device);
+    });
+
+    connect(Solid::DeviceNotifier::instance(), &Solid::DeviceNotifier::deviceAdded, this, &Storage::deviceAdded);
+    connect(Solid::DeviceNotifier::instance(), &Solid::DeviceNotifier::deviceRemoved, this, &Storage::deviceRemoved);
+    const QList<Solid::Device> volumes = Solid::Device::listFromType(Solid::DeviceInterface::StorageVolume);
+    for (const Solid::Device &device : volumes) {
+        deviceAdded(device.udi());
+    }
+
+    m_usbDirty = true;
+    m_volumesDirty = true;
+    flush();
+}
+
+void Storage::onUsbDevice(UdevHub::Action action, const UdevDevice &device)
+{
+    // Root hubs are named usbN, real devices are bus-port paths like 1-2.3
+    if (device.sysname.startsWith(QLatin1String("usb"))) {
+        return;
+    }
+
+    if (action == UdevHub::Action::Removed) {
+        if (m_usbDevices.remove(device.syspath) == 0) {
+            return;
+        }
+    } else {
+        QString vendor = device.property(QStringLiteral("ID_VENDOR_FROM_DATABASE"));
+        if (vendor.isEmpty()) {
+            vendor = device.property(QStringLiteral("ID_VENDOR"));
+        }
+        QString product = device.property(QStringLiteral("ID_MODEL_FROM_DATABASE"));
+        if (product.isEmpty()) {
+            product = device.property(QStringLiteral("ID_MODEL"));
+        }
+        QVariantMap entry;
+        entry["vendor"] = vendor;
+        entry["product"] = product;
+        entry["id"] = device.property(QStringLiteral("ID_VENDOR_ID")) + ':' + device.property(QStringLiteral("ID_MODEL_ID"));
+        if (m_usbDevices.value(device.syspath) == entry) {
+            return;
+        }
+        m_usbDevices.insert(device.syspath, entry);
+    }
+    m_usbDirty = true;
+    m_updateTimer->start();
+}
+
+void Storage::deviceAdded(const QString &udi)
+{
+    Solid::Device device(udi);
+    if (m_volumes.contains(udi) || !isRemovableVolume(device)) {
+        return;
+    }
+
+    Volume volume;
+    volume.device = device;
+    volume.label = device.description();
+
+    // One eject button per volume, keyed on the filesystem uuid so it survives replugging
+    static const QRegularExpression invalidChars(QStringLiteral("[^a-z0-9]+"));
+    QString key = device.as<Solid::StorageVolume>()->uuid();
+    if (key.isEmpty()) {
+        key = udi.section(QLatin1Char('/'), -1);
+    }
+    volume.eject = new Button(this);
+    volume.eject->setId("eject_" + key.toLower().replace(invalidChars, QStringLiteral("_")));
+    volume.eject->setName("Eject " + volume.label);
+    volume.eject->setDiscoveryConfig("icon", "mdi:eject");
+    connect(volume.eject, &Button::triggered, this, [this, udi]() {
+        eject(udi);
+    });
+    volume.eject->runtimeRegistration();
+
+    connect(device.as<Solid::StorageAccess>(), &Solid::StorageAccess::accessibilityChanged, this, [this, udi]() {
+        updateMountPoint(udi);
+    });
+
+    m_volumes.insert(udi, volume);
+    updateMountPoint(udi);
+}
+
+void Storage::deviceRemoved(const QString &udi)
+{
+    auto it = m_volumes.find(udi);
+    if (it == m_volumes.end()) {
+        return;
+    }
+    it->eject->unRegister();
+    it->eject->deleteLater();
+    const bool wasMounted = !it->mountPoint.isEmpty();
+    m_volumes.erase(it);
+    if (wasMounted) {
+        m_volumesDirty = true;
+        m_updateTimer->start();
+    }
+}
+
+void Storage::updateMountPoint(const QString &udi)
+{
+    auto it = m_volumes.find(udi);
+    if (it == m_volumes.end()) {
+        return;
+    }
+    const auto *access = it->device.as<Solid::StorageAccess>();
+    const QString mountPoint = access && access->isAccessible() ? access->filePath() : QString();
+    if (mountPoint == it->mountPoint) {
+        return;
+    }
+    it->mountPoint = mountPoint;
+    it->total = 0;
+    it->free = 0;
+    if (!mountPoint.isEmpty()) {
+        readFreeSpace(*it);
+    }
+    m_volumesDirty = true;
+    m_updateTimer->start();
+}
+
+bool Storage::readFreeSpace(Volume &volume) const
+{
+    struct statvfs stats;
+    if (statvfs(QFile::encodeName(volume.mountPoint).constData(), &stats) != 0) {
+        return false;
+    }
+    const quint64 total = quint64(stats.f_blocks) * stats.f_frsize;
+    const quint64 free = quint64(stats.f_bavail) * stats.f_frsize;
+
+    const quint64 threshold = qMin(total / 100, s_maxFreeSpaceThreshold);
+    const quint64 delta = free > volume.free ? free - volume.free : volume.free - free;
+    if (total == volume.total && delta < threshold) {
+        return false;
+    }
+    volume.total = total;
+    volume.free = free;
+    return true;
+}
+
+void Storage::sampleFreeSpace()
+{
+    for (Volume &volume : m_volumes) {
+        if (!volume.mountPoint.isEmpty() && readFreeSpace(volume)) {
+            m_volumesDirty = true;
+        }
+    }
+    if (m_volumesDirty) {
+        m_updateTimer->start();
+    }
+}
+
+void Storage::eject(const QString &udi)
+{
+    auto it = m_volumes.constFind(udi);
+    if (it == m_volumes.constEnd()) {
+        return;
+    }
+    qCDebug(storage) << "Ejecting" << it->label;
+    const Solid::Device drive = driveForVolume(it->device);
+    if (auto *optical = drive.as<Solid::OpticalDrive>()) {
+        optical->eject();
+    } else if (auto *access = it->device.as<Solid::StorageAccess>()) {
+        access->teardown();
+    }
+}
+
+void Storage::flush()
+{
+    if (m_usbDirty) {
+        m_usbDirty = false;
+        QVariantMap attributes;
+        attributes["devices"] = QVariantList(m_usbDevices.cbegin(), m_usbDevices.cend());
+        m_usbSensor->setState(QString::number(m_usbDevices.size()));
+        m_usbSensor->setAttributes(attributes);
+    }
+
+    if (m_volumesDirty) {
+        m_volumesDirty = false;
+        QVariantList volumes;
+        for (const Volume &volume : std::as_const(m_volumes)) {
+            if (volume.mountPoint.isEmpty()) {
+                continue;
+            }
+            const Solid::Device drive = driveForVolume(volume.device);
+            QVariantMap entry;
+            entry["label"] = volume.label;
+            entry["vendor"] = drive.vendor();
+            entry["product"] = drive.product();
+            entry["mount_point"] = volume.mountPoint;
+            entry["free"] = volume.free;
+            entry["total"] = volume.total;
+            volumes.append(entry);
+        }
+        QVariantMap attributes;
+        attributes["volumes"] = volumes;
+        m_volumeSensor->setState(QString::number(volumes.size()));
+        m_volumeSensor->setAttributes(attributes);
+    }
+}
+
+void setupStorage()
+{
+    new Storage(qApp);
+}
+
+REGISTER_INTEGRATION("Storage", setupStorage, true)
+
+#include "storage.moc"
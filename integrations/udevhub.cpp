@@ -0,0 +1,236 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "udevhub.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <cstring>
+#include <libudev.h>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(udevhub)
+Q_LOGGING_CATEGORY(udevhub, "integration.UdevHub")
+
+QString UdevDevice::sysattr(const QString &name) const
+{
+    QFile file(syspath + QLatin1Char('/') + name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+bool UdevFilter::matches(const UdevDevice &device) const
+{
+    if (device.subsystem != subsystem) {
+        return false;
+    }
+    if (!devtype.isEmpty() && device.devtype != devtype) {
+        return false;
+    }
+    for (auto it = properties.constBegin(); it != properties.constEnd(); ++it) {
+        if (device.properties.value(it.key()) != it.value()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+UdevHub *UdevHub::self()
+{
+    static UdevHub *s_self = new UdevHub(qApp);
+    return s_self;
+}
+
+UdevHub::UdevHub(QObject *parent)
+    : QObject(parent)
+{
+    m_udev = udev_new();
+    if (!m_udev) {
+        qCWarning(udevhub) << "Failed to create udev context";
+        return;
+    }
+    m_monitor = udev_monitor_new_from_netlink(m_udev, "udev");
+    if (!m_monitor) {
+        qCWarning(udevhub) << "Failed to create udev monitor";
+        return;
+    }
+    // Subsystem filters are added as integrations subscribe, see ensureSubsystem()
+    udev_monitor_enable_receiving(m_monitor);
+
+    m_notifier = new QSocketNotifier(udev_monitor_get_fd(m_monitor), QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &UdevHub::onActivated);
+}
+
+UdevHub::~UdevHub()
+{
+    if (m_monitor)
+        udev_monitor_unref(m_monitor);
+    if (m_udev)
+        udev_unref(m_udev);
+}
+
+UdevDevice UdevHub::snapshot(udev_device *dev) const
+{
+    UdevDevice device;
+    device.syspath = QString::fromUtf8(udev_device_get_syspath(dev));
+    device.sysname = QString::fromUtf8(udev_device_get_sysname(dev));
+    device.subsystem = QString::fromUtf8(udev_device_get_subsystem(dev));
+    device.devtype = QString::fromUtf8(udev_device_get_devtype(dev));
+    device.devnode = QString::fromUtf8(udev_device_get_devnode(dev));
+
+    udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(dev))
+    {
+        device.properties.insert(QString::fromUtf8(udev_list_entry_get_name(entry)), QString::fromUtf8(udev_list_entry_get_value(entry)));
+    }
+
+    // parents are owned by the child device, no unref
+    for (udev_device *parent = udev_device_get_parent(dev); parent; parent = udev_device_get_parent(parent)) {
+        const QString subsystem = QString::fromUtf8(udev_device_get_subsystem(parent));
+        if (!subsystem.isEmpty() && !device.ancestors.contains(subsystem)) {
+            device.ancestors.insert(subsystem, QString::fromUtf8(udev_device_get_syspath(parent)));
+        }
+    }
+    return device;
+}
+
+void UdevHub::ensureSubsystem(const QString &subsystem)
+{
+    if (!m_monitor || m_devices.contains(subsystem)) {
+        return;
+    }
+    QHash<QString, UdevDevice> &devices = m_devices[subsystem];
+
+    // Start listening before enumerating so nothing falls in between
+    const QByteArray subsystemName = subsystem.toUtf8();
+    udev_monitor_filter_add_match_subsystem_devtype(m_monitor, subsystemName.constData(), nullptr);
+    udev_monitor_filter_update(m_monitor);
+
+    udev_enumerate *enumerate = udev_enumerate_new(m_udev);
+    udev_enumerate_add_match_subsystem(enumerate, subsystemName.constData());
+    udev_enumerate_scan_devices(enumerate);
+
+    udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate))
+    {
+        udev_device *dev = udev_device_new_from_syspath(m_udev, udev_list_entry_get_name(entry));
+        if (dev) {
+            const UdevDevice device = snapshot(dev);
+            devices.insert(device.syspath, device);
+            udev_device_unref(dev);
+        }
+    }
+    udev_enumerate_unref(enumerate);
+    qCDebug(udevhub) << "Tracking" << devices.size() << "devices in subsystem" << subsystem;
+}
+
+int UdevHub::subscribe(const UdevFilter &filter, QObject *context, const Callback &callback)
+{
+    ensureSubsystem(filter.subsystem);
+
+    const int id = m_nextSubscription++;
+    // Disconnected again on unsubscribe, long lived contexts would collect these otherwise
+    const QMetaObject::Connection contextConnection = connect(context, &QObject::destroyed, this, [this, id]() {
+        unsubscribe(id);
+    });
+    m_subscriptions.insert(id, {filter, context, callback, contextConnection});
+    m_subscriptionsBySubsystem[filter.subsystem].append(id);
+
+    const QList<UdevDevice> present = devices(filter);
+    for (const UdevDevice &device : present) {
+        callback(Action::Added, device);
+    }
+    return id;
+}
+
+void UdevHub::unsubscribe(int subscription)
+{
+    auto it = m_subscriptions.find(subscription);
+    if (it == m_subscriptions.end()) {
+        return;
+    }
+    // The device set of the subsystem is kept, it's cheap and saves a rescan on the next subscriber
+    m_subscriptionsBySubsystem[it->filter.subsystem].removeOne(subscription);
+    disconnect(it->contextConnection);
+    m_subscriptions.erase(it);
+}
+
+QList<UdevDevice> UdevHub::devices(const UdevFilter &filter) const
+{
+    QList<UdevDevice> result;
+    const QHash<QString, UdevDevice> devices = m_devices.value(filter.subsystem);
+    for (const UdevDevice &device : devices) {
+        if (filter.matches(device)) {
+            result.append(device);
+        }
+    }
+    return result;
+}
+
+void UdevHub::onActivated()
+{
+    udev_device *dev;
+    while ((dev = udev_monitor_receive_device(m_monitor))) {
+        const char *actionName = udev_device_get_action(dev);
+        const UdevDevice device = snapshot(dev);
+        udev_device_unref(dev);
+
+        auto subsystemIt = m_devices.find(device.subsystem);
+        if (!actionName || subsystemIt == m_devices.end()) {
+            continue;
+        }
+
+        if (strcmp(actionName, "remove") == 0) {
+            // sysfs is gone by now, describe the device as we last saw it
+            auto it = subsystemIt->find(device.syspath);
+            if (it != subsystemIt->end()) {
+                const UdevDevice previous = it.value();
+                subsystemIt->erase(it);
+                dispatch(Action::Removed, previous);
+            }
+        } else if (strcmp(actionName, "add") == 0 || strcmp(actionName, "change") == 0 || strcmp(actionName, "bind") == 0) {
+            auto it = subsystemIt->find(device.syspath);
+            if (it == subsystemIt->end()) {
+                subsystemIt->insert(device.syspath, device);
+                dispatch(Action::Added, device);
+            } else {
+                const UdevDevice previous = it.value();
+                it.value() = device;
+                dispatch(Action::Changed, device, &previous);
+            }
+        }
+    }
+}
+
+void UdevHub::dispatch(Action action, const UdevDevice &device, const UdevDevice *previous)
+{
+    // Callbacks may subscribe or unsubscribe, iterate over a copy
+    const QList<int> ids = m_subscriptionsBySubsystem.value(device.subsystem);
+    for (int id : ids) {
+        auto it = m_subscriptions.constFind(id);
+        if (it == m_subscriptions.constEnd() || !it->context) {
+            continue;
+        }
+        const bool matchesNow = it->filter.matches(device);
+        const bool matchedBefore = previous && it->filter.matches(*previous);
+        Action delivered = action;
+        if (action == Action::Changed) {
+            // A change can make a device enter or leave a filter, e.g. a property appearing
+            if (matchesNow && !matchedBefore) {
+                delivered = Action::Added;
+            } else if (!matchesNow && matchedBefore) {
+                delivered = Action::Removed;
+            } else if (!matchesNow) {
+                continue;
+            }
+        } else if (!matchesNow) {
+            continue;
+        }
+        const Callback callback = it->callback;
+        callback(delivered, device);
+    }
+}
@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+#include <functional>
+
+class QSocketNotifier;
+struct udev;
+struct udev_device;
+struct udev_monitor;
+
+// Snapshot of a udev device, kept by UdevHub so removals can still be described
+// after the device is gone from sysfs
+struct UdevDevice {
+    QString syspath;
+    QString sysname;
+    QString subsystem;
+    QString devtype;
+    QString devnode;
+    QHash<QString, QString> properties;
+    // nearest ancestor syspath for each subsystem above this device, e.g. "hid", "usb"
+    QHash<QString, QString> ancestors;
+
+    QString property(const QString &key) const
+    {
+        return properties.value(key);
+    }
+    // read on demand from sysfs, empty if the device is gone
+    QString sysattr(const QString &name) const;
+};
+
+struct UdevFilter {
+    QString subsystem;
+    QString devtype; // optional
+    QHash<QString, QString> properties; // all have to match
+
+    bool matches(const UdevDevice &device) const;
+};
+
+// One udev netlink monitor shared by every integration. Devices are enumerated once
+// per subsystem when the first subscriber shows up and then tracked incrementally,
+// so a hotplug event costs O(subscribers) instead of a rescan.
+
+class UdevHub : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Action {
+        Added,
+        Changed,
+        Removed,
+    };
+    using Callback = std::function<void(Action action, const UdevDevice &device)>;
+
+    static UdevHub *self();
+
+    // Matching devices that are already present are reported as Added before this returns.
+    // The subscription is dropped automatically when context is destroyed.
+    int subscribe(const UdevFilter &filter, QObject *context, const Callback &callback);
+    void unsubscribe(int subscription);
+
+    QList<UdevDevice> devices(const UdevFilter &filter) const;
+
+private:
+    explicit UdevHub(QObject *parent);
+    ~UdevHub() override;
+
+    void onActivated();
+    void ensureSubsystem(const QString &subsystem);
+    UdevDevice snapshot(udev_device *dev) const;
+    void dispatch(Action action, const UdevDevice &device, const UdevDevice *previous = nullptr);
+
+    struct Subscription {
+        UdevFilter filter;
+        QPointer<QObject> context;
+        Callback callback;
+        QMetaObject::Connection contextConnection;
+    };
+
+    udev *m_udev = nullptr;
+    udev_monitor *m_monitor = nullptr;
+    QSocketNotifier *m_notifier = nullptr;
+    QHash<QString, QHash<QString, UdevDevice>> m_devices; // subsystem -> syspath -> device
+    QHash<QString, QList<int>> m_subscriptionsBySubsystem;
+    QHash<int, Subscription> m_subscriptions;
+    int m_nextSubscription = 1;
+};
@@ -0,0 +1,257 @@
+// SPDX-FileCopyrightText: 2025 Odd Østlie <theoddpirate@gmail.com>
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "core.h"
+#include "entities/entities.h"
+#include "kwinscript.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusVariant>
+#include <QTimer>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(vd)
+Q_LOGGING_CATEGORY(vd, "integration.VirtualDesktop")
+
+// Renaming a desktop emits a change per keystroke, wait for it to settle before
+// republishing the options in the discovery config
+static constexpr int s_optionsSettleInterval = 1000;
+
+// Options are names, HA has no id/label split for selects. Duplicates get a number appended.
+static QStringList uniqueNames(const QStringList &names)
+{
+    QStringList result;
+    for (const QString &name : names) {
+        QString candidate = name;
+        for (int i = 2; result.contains(candidate); ++i) {
+            candidate = QStringLiteral("%1 (%2)").arg(name).arg(i);
+        }
+        result.append(candidate);
+    }
+    return result;
+}
+
+class VirtualDesktop : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VirtualDesktop(QObject *parent = nullptr);
+
+private Q_SLOTS:
+    void activityNameChanged(const QString &id, const QString &name);
+
+private:
+    void onDesktop(const QVariantMap &event);
+    void onActivity(const QVariantMap &event);
+    void requestActivityName(const QString &id);
+    void updateActivity();
+    void setCurrentDesktop(const QString &option);
+    void setCurrentActivity(const QString &option);
+    void publishOptions();
+
+    // Created with their first non-empty option list, HA rejects a select without options.
+    // Without KWin or activities they never show up
+    Select *m_desktop = nullptr;
+    Select *m_activity = nullptr;
+    QTimer *m_optionsTimer;
+
+    QStringList m_desktopIds;
+    QStringList m_desktopOptions;
+    QString m_desktopState; // option of the current desktop
+
+    QStringList m_activityIds;
+    QHash<QString, QString> m_activityNames; // id -> name
+    QStringList m_activityOptions;
+    QString m_currentActivity; // id
+    QString m_activityState; // option of the current activity
+};
+
+VirtualDesktop::VirtualDesktop(QObject *parent)
+    : QObject(parent)
+    , m_optionsTimer(new QTimer(this))
+{
+    // Not restarted, so a long rename still publishes at most once a second
+    m_optionsTimer->setSingleShot(true);
+    m_optionsTimer->setInterval(s_optionsSettleInterval);
+    connect(m_optionsTimer, &QTimer::timeout, this, &VirtualDesktop::publishOptions);
+
+    KWinScript::self()->subscribe(QStringLiteral("desktop"), this, [this](const QVariantMap &event) {
+        onDesktop(event);
+    });
+    KWinScript::self()->subscribe(QStringLiteral("activity"), this, [this](const QVariantMap &event) {
+        onActivity(event);
+    });
+
+    QDBusConnection::sessionBus().connect(QStringLiteral("org.kde.ActivityManager"),
+                                          QStringLiteral("/ActivityManager/Activities"),
+                                          QStringLiteral("org.kde.ActivityManager.Activities"),
+                                          QStringLiteral("ActivityNameChanged"),
+                                          this,
+                                          SLOT(activityNameChanged(QString, QString)));
+}
+
+void VirtualDesktop::publishOptions()
+{
+    if (!m_desktop && !m_desktopOptions.isEmpty()) {
+        m_desktop = new Select(this);
+        m_desktop->setId("virtual_desktop");
+        m_desktop->setName("Virtual Desktop");
+        m_desktop->setDiscoveryConfig("icon", "mdi:monitor-multiple");
+        connect(m_desktop, &Select::optionSelected, this, &VirtualDesktop::setCurrentDesktop);
+        m_desktop->setOptions(m_desktopOptions);
+        m_desktop->setState(m_desktopState);
+        m_desktop->runtimeRegistration();
+    } else if (m_desktop && !m_desktopOptions.isEmpty()) {
+        m_desktop->setOptions(m_desktopOptions);
+        m_desktop->setState(m_desktopState);
+    }
+
+    if (!m_activity && !m_activityOptions.isEmpty()) {
+        m_activity = new Select(this);
+        m_activity->setId("activity");
+        m_activity->setName("Activity");
+        m_activity->setDiscoveryConfig("icon", "mdi:view-dashboard-variant");
+        connect(m_activity, &Select::optionSelected, this, &VirtualDesktop::setCurrentActivity);
+        m_activity->setOptions(m_activityOptions);
+        m_activity->setState(m_activityState);
+        m_activity->runtimeRegistration();
+    } else if (m_activity && !m_activityOptions.isEmpty()) {
+        m_activity->setOptions(m_activityOptions);
+        m_activity->setState(m_activityState);
+    }
+}
+
+void VirtualDesktop::onDesktop(const QVariantMap &event)
+{
+    QStringList ids;
+    QStringList names;
+    const QVariantList desktops = event.value("desktops").toList();
+    for (const QVariant &desktop : desktops) {
+        const QVariantMap map = desktop.toMap();
+        ids.append(map.value("id").toString());
+        names.append(map.value("name").toString());
+    }
+    m_desktopIds = ids;
+    const QStringList options = uniqueNames(names);
+    const int index = ids.indexOf(event.value("id").toString());
+    m_desktopState = options.value(index);
+
+    // Switching desktops is the common case and only touches the state topic
+    if (options == m_desktopOptions) {
+        if (m_desktop && !m_optionsTimer->isActive() && m_desktop->state() != m_desktopState) {
+            m_desktop->setState(m_desktopState);
+        }
+        return;
+    }
+    m_desktopOptions = options;
+    if (!m_optionsTimer->isActive()) {
+        m_optionsTimer->start();
+    }
+}
+
+void VirtualDesktop::onActivity(const QVariantMap &event)
+{
+    m_activityIds = event.value("activities").toStringList();
+    m_currentActivity = event.value("id").toString();
+    for (const QString &id : std::as_const(m_activityIds)) {
+        if (!m_activityNames.contains(id)) {
+            requestActivityName(id);
+        }
+    }
+    updateActivity();
+}
+
+void VirtualDesktop::requestActivityName(const QString &id)
+{
+    // Placeholder until ActivityManager answers, so the request isn't sent twice
+    m_activityNames.insert(id, id);
+    auto message = QDBusMessage::createMethodCall(QStringLiteral("org.kde.ActivityManager"),
+                                                  QStringLiteral("/ActivityManager/Activities"),
+                                                  QStringLiteral("org.kde.ActivityManager.Activities"),
+                                                  QStringLiteral("ActivityName"));
+    message << id;
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, id](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<QString> reply = *call;
+        call->deleteLater();
+        if (reply.isError()) {
+            qCWarning(vd) << "Failed to get activity name for" << id << reply.error().message();
+            return;
+        }
+        activityNameChanged(id, reply.value());
+    });
+}
+
+void VirtualDesktop::activityNameChanged(const QString &id, const QString &name)
+{
+    if (m_activityNames.value(id) == name) {
+        return;
+    }
+    m_activityNames.insert(id, name);
+    updateActivity();
+}
+
+void VirtualDesktop::updateActivity()
+{
+    QStringList names;
+    for (const QString &id : std::as_const(m_activityIds)) {
+        names.append(m_activityNames.value(id, id));
+    }
+    const QStringList options = uniqueNames(names);
+    m_activityState = options.value(m_activityIds.indexOf(m_currentActivity));
+
+    if (options == m_activityOptions) {
+        if (m_activity && !m_optionsTimer->isActive() && m_activity->state() != m_activityState) {
+            m_activity->setState(m_activityState);
+        }
+        return;
+    }
+    m_activityOptions = options;
+    if (!m_optionsTimer->isActive()) {
+        m_optionsTimer->start();
+    }
+}
+
+void VirtualDesktop::setCurrentDesktop(const QString &option)
+{
+    const QString id = m_desktopIds.value(m_desktopOptions.indexOf(option));
+    if (id.isEmpty()) {
+        qCWarning(vd) << "Unknown desktop" << option;
+        return;
+    }
+    // KWin follows up with currentDesktopChanged, which is what updates the state
+    auto message = QDBusMessage::createMethodCall(QStringLiteral("org.kde.KWin"),
+                                                  QStringLiteral("/VirtualDesktopManager"),
+                                                  QStringLiteral("org.freedesktop.DBus.Properties"),
+                                                  QStringLiteral("Set"));
+    message << QStringLiteral("org.kde.KWin.VirtualDesktopManager") << QStringLiteral("current") << QVariant::fromValue(QDBusVariant(id));
+    QDBusConnection::sessionBus().asyncCall(message);
+}
+
+void VirtualDesktop::setCurrentActivity(const QString &option)
+{
+    const QString id = m_activityIds.value(m_activityOptions.indexOf(option));
+    if (id.isEmpty()) {
+        qCWarning(vd) << "Unknown activity" << option;
+        return;
+    }
+    auto message = QDBusMessage::createMethodCall(QStringLiteral("org.kde.ActivityManager"),
+                                                  QStringLiteral("/ActivityManager/Activities"),
+                                                  QStringLiteral("org.kde.ActivityManager.Activities"),
+                                                  QStringLiteral("SetCurrentActivity"));
+    message << id;
+    QDBusConnection::sessionBus().asyncCall(message);
+}
+
+void setupVirtualDesktop()
+{
+    new VirtualDesktop(qApp);
+}
+
+REGISTER_INTEGRATION("VirtualDesktop", setupVirtualDesktop, true)
+
+#include "virtualdesktop.moc"